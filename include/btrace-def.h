@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __BTRACE_DEF_H__
+#define __BTRACE_DEF_H__
+
+/* Format of the binary trace written by src/utils/btrace.c and read by
+ * tools/btrace-dump.
+ *
+ * The file starts with a BTraceHeader, which is followed by records.
+ * Unsigned fields are LEB128 varints, and signed fields are zigzag
+ * encoded before that. A record starts with a tag byte, whose lowest
+ * two bits are the type of the record:
+ *
+ * BTRACE_INST: tag[5:2] = length of the instruction - 1,
+ *   tag[6] = 1 if the pc is not the end of the previous instruction.
+ *   If so, the delta from the end of the previous instruction follows
+ *   as a signed field. Then follow the bytes of the instruction.
+ * BTRACE_MEM: tag[2] = 1 for a write, tag[4:3] = log2(length).
+ *   The delta from the address of the previous memory access follows
+ *   as a signed field, then the data.
+ * BTRACE_DEV: tag[2] = 1 for a write, tag[4:3] = log2(length).
+ *   The id of the device, the offset in it, and the data follow.
+ * BTRACE_MAP: tag[4] = 0. The id, the base address and the name
+ *   (terminated by '\0') of a device. It precedes the first BTRACE_DEV
+ *   record of the device.
+ * BTRACE_MAP | BTRACE_PMEM: tag[2] = 1 for a write, tag[6:5] = log2(length).
+ *   An access to a physical address range traced by mtrace. The delta of
+ *   the pc from that of the previous such record, the delta of the address
+ *   from that of the previous such record, and the data follow as fields.
+ *
+ * The memory and device records made by an instruction precede its
+ * BTRACE_INST record.
+ */
+
+#include <stdint.h>
+
+#define BTRACE_MAGIC "NEMUBT1"
+
+typedef struct {
+  char magic[8];
+  char isa[16]; // e.g. "riscv32"
+} BTraceHeader;
+
+enum { BTRACE_INST, BTRACE_MEM, BTRACE_DEV, BTRACE_MAP };
+
+#define BTRACE_INST_JUMP 0x40
+#define BTRACE_WRITE     0x04
+#define BTRACE_PMEM      0x10
+#define BTRACE_MAX_NAME  32
+
+#endif
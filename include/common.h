@@ -31,7 +31,7 @@
 #include <stdlib.h>
 #endif
 
-#if CONFIG_MBASE + CONFIG_MSIZE > 0x100000000ul
+#if CONFIG_MBASE + CONFIG_MSIZE > 0x100000000ul || defined(CONFIG_PMEM_EXTRA)
 #define PMEM64 1
 #endif
 
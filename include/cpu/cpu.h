@@ -20,6 +20,13 @@
 
 void cpu_exec(uint64_t n);
 
+/* The CPU loop runs at most `g_stop_budget` instructions before it looks at
+ * device events, watchpoints and the state of NEMU. Anything which needs the
+ * loop to look at them earlier (e.g. a state change) zeroes the budget.
+ */
+extern int64_t g_stop_budget;
+static inline void cpu_request_stop() { g_stop_budget = 0; }
+
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
 
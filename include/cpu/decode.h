@@ -23,9 +23,41 @@ typedef struct Decode {
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
-  IFDEF(CONFIG_ITRACE, char logbuf[128]);
+  IFDEF(CONFIG_DECODE_HANDLER, const void *handler); // body of the matched pattern
 } Decode;
 
+#ifdef CONFIG_ITRACE
+/* A traced instruction is kept in this raw form, and
+ * it is formatted only when it is actually output.
+ */
+typedef struct {
+  vaddr_t pc;
+  uint8_t len;
+  uint8_t inst[sizeof(((ISADecodeInfo *)0)->inst)];
+} ITraceRecord;
+
+static inline void itrace_capture(ITraceRecord *r, Decode *s) {
+  r->pc = s->pc;
+  r->len = s->snpc - s->pc;
+  memcpy(r->inst, &s->isa.inst, sizeof(r->inst));
+}
+
+// format `r` as "pc: instruction bytes  disassembly"
+void itrace_format(char *buf, int size, const ITraceRecord *r);
+#endif
+
+#ifdef CONFIG_IRINGBUF
+extern ITraceRecord iringbuf[CONFIG_IRINGBUF_SIZE];
+extern int iringbuf_idx;
+
+static inline void iringbuf_push(Decode *s) {
+  itrace_capture(&iringbuf[iringbuf_idx], s);
+  if (++ iringbuf_idx == CONFIG_IRINGBUF_SIZE) iringbuf_idx = 0;
+}
+
+void iringbuf_dump();
+#endif
+
 // --- pattern matching mechanism ---
 __attribute__((always_inline))
 static inline void pattern_decode(const char *str, int len,
@@ -87,16 +119,61 @@ finish:
 
 
 // --- pattern matching wrappers for decode ---
+#ifdef CONFIG_ENGINE_BLOCK
+// Threaded code: `s` points into an array of decoded instructions, which is
+// terminated by an entry without handler. Jump to the body of the next one
+// directly, unless the current instruction transfers control.
+#define INSTPAT_DISPATCH(s) do { \
+  if (likely((s)->dnpc == (s)->snpc && (s)[1].handler != NULL)) { \
+    (s) ++; \
+    (s)->dnpc = (s)->snpc; \
+    goto *((s)->handler); \
+  } \
+  goto *(__instpat_end); \
+} while (0)
+#else
+#define INSTPAT_DISPATCH(s) goto *(__instpat_end)
+#endif
+
+#ifdef CONFIG_DECODE_TREE
+#include <decode-tree.h>
+
+// The patterns are matched by decode_tree_<line>() generated from the line
+// of INSTPAT_START(), which returns the index of the matched pattern in
+// DECODE_TREE_TARGET_<line>, or the number of patterns if none is matched.
+// Each pattern is labeled by its own line to be the jump target.
+#define INSTPAT(pattern, ...) do { \
+  concat(__instpat_line_, __LINE__): \
+  INSTPAT_MATCH(s, ##__VA_ARGS__); \
+  INSTPAT_DISPATCH(s); \
+} while (0)
+
+#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name); \
+  IFDEF(CONFIG_DECODE_HANDLER, if (s->handler != NULL) goto *(s->handler)); \
+  static const void *__instpat_target[] = { \
+    concat(DECODE_TREE_TARGET_, __LINE__), &&concat(__instpat_end_, name) }; \
+  goto *__instpat_target[concat(decode_tree_, __LINE__)(INSTPAT_INST(s))];
+#else
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
-    goto *(__instpat_end); \
+    INSTPAT_DISPATCH(s); \
   } \
 } while (0)
 
-#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name);
+#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name); \
+  IFDEF(CONFIG_DECODE_HANDLER, if (s->handler != NULL) goto *(s->handler));
+#endif
+
+// Mark the execute body of a pattern. It should be placed by INSTPAT_MATCH()
+// after the operands are decoded, so that an instruction found in the decode
+// cache can jump to its body directly.
+#define INSTPAT_BODY(s, name) \
+  IFDEF(CONFIG_DECODE_HANDLER, (s)->handler = &&concat(__instpat_body_, name); \
+      concat(__instpat_body_, name): ;)
+
 #define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
 
 #endif
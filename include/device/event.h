@@ -0,0 +1,33 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+typedef void (*event_handler_t) ();
+
+/* Call `h` after `delay` us of host time, and then every `period` us if
+ * `period` is not 0. Handlers are called between guest instructions.
+ */
+void add_event(event_handler_t h, uint64_t delay, uint64_t period);
+
+/* Call the handlers of expired events. Return the number of guest
+ * instructions the CPU loop can run before calling it again.
+ */
+int64_t event_dispatch();
+
+#endif
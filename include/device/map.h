@@ -17,9 +17,13 @@
 #define __DEVICE_MAP_H__
 
 #include <cpu/difftest.h>
+#include <memory/paddr.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
-uint8_t* new_space(int size);
+// the page aligned backing space of a device
+uint8_t* new_space(const char *name, int size);
+// the same for a large space such as a frame buffer, which is eligible for huge pages
+uint8_t* new_large_space(const char *name, int size);
 
 typedef struct {
   const char *name;
@@ -34,23 +38,46 @@ static inline bool map_inside(IOMap *map, paddr_t addr) {
   return (addr >= map->low && addr <= map->high);
 }
 
-static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
-  int i;
-  for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
+/* A set of maps with a page table to find the map of an address in
+ * constant time. An entry of the page table is 0 if no map is in the
+ * page, or points to the map if only one is in it. Otherwise it points
+ * to the numbers (1-based) of the maps for each byte in the page, and
+ * is tagged by the lowest bit.
+ */
+#define IOMAP_DIR_SHIFT 22
+typedef struct {
+  IOMap **maps;
+  int nr_map;
+  uintptr_t *dir[1ull << (PADDR_BITS - IOMAP_DIR_SHIFT)];
+} IOMapTable;
+
+// Add a copy of `map' to `t', and return the copy.
+IOMap* map_table_add(IOMapTable *t, const IOMap *map);
+
+static inline IOMap* map_table_find(IOMapTable *t, paddr_t addr) {
+  if (((uint64_t)addr >> PADDR_BITS) != 0) return NULL;
+  uintptr_t *pt = t->dir[addr >> IOMAP_DIR_SHIFT];
+  if (pt == NULL) return NULL;
+  uintptr_t e = pt[BITS(addr, IOMAP_DIR_SHIFT - 1, PMEM_PAGE_SHIFT)];
+  if ((e & 1) == 0) {
+    IOMap *map = (IOMap *)e;
+    return (map != NULL && map_inside(map, addr) ? map : NULL);
   }
-  return -1;
+  uint16_t id = ((uint16_t *)(e - 1))[BITS(addr, PMEM_PAGE_SHIFT - 1, 0)];
+  return (id == 0 ? NULL : t->maps[id - 1]);
 }
 
 void add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
+/* A passive map has no callback, and its space is only memory (e.g. a frame
+ * buffer). It is accessed like pmem with host loads and stores, and pages
+ * written by the guest are found with pmem_dirty_scan_range().
+ */
 void add_mmio_map(const char *name, paddr_t addr,
-        void *space, uint32_t len, io_callback_t callback);
+        void *space, uint32_t len, io_callback_t callback, bool passive);
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
+void map_statistic();
 
 #endif
@@ -48,7 +48,11 @@ enum { MEM_RET_OK, MEM_RET_FAIL, MEM_RET_CROSS_PAGE };
 #ifndef isa_mmu_check
 int isa_mmu_check(vaddr_t vaddr, int len, int type);
 #endif
+// return the base of the physical page, with MEM_RET_* in the page offset
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
+#ifndef isa_mmu_asid
+#define isa_mmu_asid() 0 // address space identifier of the software TLB
+#endif
 
 // interrupt/exception
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
@@ -27,11 +27,81 @@ uint8_t* guest_to_host(paddr_t paddr);
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 paddr_t host_to_guest(uint8_t *haddr);
 
+/* Guest physical memory consists of regions, the first of which is
+ * [PMEM_LEFT, PMEM_RIGHT]. They are found with a two-level table like
+ * a page table: pmem_dir[] covers PMEM_DIR_SIZE bytes with each entry,
+ * and points to the host addresses of the pages, or is NULL if none of
+ * them is in a region. Addresses not in any region (e.g. MMIO) get NULL.
+ */
+#define PMEM_PAGE_SHIFT 12
+#define PMEM_DIR_SHIFT  22
+#define PMEM_DIR_SIZE   (1ull << PMEM_DIR_SHIFT)
+#define PADDR_BITS MUXDEF(PMEM64, 40, 32)
+extern uint8_t **pmem_dir[1ull << (PADDR_BITS - PMEM_DIR_SHIFT)];
+
+// Return the host address of `addr', or NULL if it is not in a region.
+static inline uint8_t *pmem_host(paddr_t addr) {
+  if (((uint64_t)addr >> PADDR_BITS) != 0) return NULL;
+  uint8_t **pt = pmem_dir[addr >> PMEM_DIR_SHIFT];
+  if (pt == NULL) return NULL;
+  uint8_t *page = pt[BITS(addr, PMEM_DIR_SHIFT - 1, PMEM_PAGE_SHIFT)];
+  return page == NULL ? NULL : page + BITS(addr, PMEM_PAGE_SHIFT - 1, 0);
+}
+
 static inline bool in_pmem(paddr_t addr) {
-  return addr - CONFIG_MBASE < CONFIG_MSIZE;
+  return pmem_host(addr) != NULL;
 }
 
+// Return the host address of an aligned access to pmem, or NULL if the
+// access should go through paddr_read() and paddr_write().
+static inline uint8_t *paddr_host(paddr_t addr, int len) {
+  if ((addr & (len - 1)) != 0) return NULL;
+  return pmem_host(addr);
+}
+
+#ifdef CONFIG_PMEM_DIRTY
+// one flag for each page of the physical address space
+extern uint8_t pmem_dirty[1ull << (PADDR_BITS - PMEM_PAGE_SHIFT)];
+#define pmem_set_dirty(addr) (pmem_dirty[(addr) >> PMEM_PAGE_SHIFT] = 1)
+#else
+#define pmem_set_dirty(addr)
+#endif
+// Call `callback' (if not NULL) with each run of dirty pages in pmem,
+// and clear their dirty flags if `clear' is true.
+void pmem_dirty_scan(void (*callback)(paddr_t addr, uint64_t len), bool clear);
+// the same for the pages in [addr, addr + len)
+void pmem_dirty_scan_range(paddr_t addr, uint64_t len,
+    void (*callback)(paddr_t addr, uint64_t len), bool clear);
+
+/* Caches of decoded or translated code mark the pages their instructions
+ * are fetched from. The first write to a marked page clears the mark and
+ * calls the callbacks registered by pmem_add_code_callback() with the
+ * address of the page, which should drop the code cached from it.
+ */
+#ifdef CONFIG_PMEM_CODE_PAGES
+// one flag for each page of the physical address space
+extern uint8_t pmem_code[1ull << (PADDR_BITS - PMEM_PAGE_SHIFT)];
+void pmem_code_written(paddr_t addr);
+#define pmem_mark_code(addr) (pmem_code[(addr) >> PMEM_PAGE_SHIFT] = 1)
+#define pmem_check_code(addr) do { \
+  if (unlikely(pmem_code[(addr) >> PMEM_PAGE_SHIFT])) pmem_code_written(addr); \
+} while (0)
+#else
+#define pmem_mark_code(addr) ((void)0)
+#define pmem_check_code(addr)
+#endif
+void pmem_add_code_callback(void (*callback)(paddr_t page));
+
+// Map the memory of a device at `host' to [addr, addr + len) as a region,
+// which is accessed directly like pmem instead of through MMIO.
+void pmem_add_device_region(paddr_t addr, uint64_t len, uint8_t *host);
+
+void pmem_prefault(paddr_t addr, size_t len);
+bool pmem_map_file(paddr_t addr, int fd, size_t len);
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
+void paddr_read_bulk(paddr_t addr, void *buf, size_t len);
+void paddr_write_bulk(paddr_t addr, const void *buf, size_t len);
 
 #endif
@@ -0,0 +1,36 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MEMORY_TLB_H__
+#define __MEMORY_TLB_H__
+
+#include <isa.h>
+#include <memory/vaddr.h>
+
+// TLBEntry and the lookup of the TLB are in memory/vaddr.h
+
+// Called by isa_mmu_translate() to cache a translation of `size` bytes.
+void tlb_fill(int type, vaddr_t vaddr, paddr_t ppage, vaddr_t size, uint32_t asid, bool global, bool writable);
+// Walk the page table on a TLB miss, and return the physical address.
+paddr_t tlb_refill(vaddr_t vaddr, int len, int type);
+// Drop the translations of `vaddr` (all if `all_vaddr`) of
+// non-global mappings in `asid` (all mappings if `all_asid`).
+void tlb_flush(vaddr_t vaddr, bool all_vaddr, uint32_t asid, bool all_asid);
+void init_tlb();
+void tlb_statistic();
+
+extern uint64_t tlb_nr_pte_read; // counted by the page table walker
+
+#endif
@@ -16,14 +16,101 @@
 #ifndef __MEMORY_VADDR_H__
 #define __MEMORY_VADDR_H__
 
-#include <common.h>
-
-word_t vaddr_ifetch(vaddr_t addr, int len);
-word_t vaddr_read(vaddr_t addr, int len);
-void vaddr_write(vaddr_t addr, int len, word_t data);
+#include <isa.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
 
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
 
+// the general paths, taken when the fast paths below do not apply
+word_t vaddr_ifetch_slow(vaddr_t addr, int len);
+word_t vaddr_read_slow(vaddr_t addr, int len);
+void vaddr_write_slow(vaddr_t addr, int len, word_t data);
+// copy `len' bytes between the virtual memory at `addr' and `buf'
+void vaddr_read_bulk(vaddr_t addr, void *buf, size_t len);
+void vaddr_write_bulk(vaddr_t addr, const void *buf, size_t len);
+// Mark the page of the instruction at `pc' with pmem_mark_code() before
+// caching it, and return the physical address of the instruction.
+paddr_t vaddr_mark_code(vaddr_t pc);
+
+/* The software TLB. Translations are filled by the page table walker on a
+ * miss (see memory/tlb.h), and hits are checked by the fast paths below.
+ */
+#define TLB_SIZE CONFIG_TLB_SIZE
+#define TLB_INVALID ((vaddr_t)-1)
+
+enum { TLB_I, TLB_D, NR_TLB };
+
+typedef struct {
+  vaddr_t vpn;        // TLB_INVALID if the entry is not valid
+  vaddr_t vpn_mask;   // the bits of vpn translated by this entry
+  uint32_t asid;
+  uint32_t asid_mask; // 0 for a global mapping, which matches any ASID
+  paddr_t ppage;      // the base of the physical page
+  bool writable;      // false if a write should walk the page table (e.g. to set the dirty bit)
+} TLBEntry;
+
+extern TLBEntry tlb[NR_TLB][TLB_SIZE];
+extern uint64_t tlb_nr_hit[NR_TLB];
+
+static inline TLBEntry *tlb_entry(int type, vaddr_t vaddr) {
+  vaddr_t vpn = vaddr >> PAGE_SHIFT;
+  return &tlb[type != MEM_TYPE_IFETCH][vpn & (TLB_SIZE - 1)];
+}
+
+static inline bool tlb_hit(TLBEntry *e, vaddr_t vaddr, int type) {
+  return e->vpn == (vaddr >> PAGE_SHIFT) && ((e->asid ^ isa_mmu_asid()) & e->asid_mask) == 0 &&
+    (type != MEM_TYPE_WRITE || e->writable);
+}
+
+/* Fast paths for aligned accesses to pmem with the MMU off or a TLB hit:
+ * a two-level lookup in pmem_dir[] (see pmem_host()) and a host load or
+ * store. `paddr' is set to the physical address of the access.
+ */
+static inline uint8_t *vaddr_host(vaddr_t addr, int len, int type, paddr_t *paddr) {
+  if (likely(isa_mmu_check(addr, len, type) == MMU_DIRECT)) {
+    *paddr = addr;
+    return paddr_host(addr, len);
+  }
+  // an aligned access does not cross a page boundary
+  if ((addr & (len - 1)) != 0) return NULL;
+  TLBEntry *e = tlb_entry(type, addr);
+  if (unlikely(!tlb_hit(e, addr, type))) return NULL;
+  *paddr = e->ppage | (addr & PAGE_MASK);
+  uint8_t *host = pmem_host(*paddr);
+  // other accesses are counted by the slow paths
+  if (likely(host != NULL)) tlb_nr_hit[type != MEM_TYPE_IFETCH] ++;
+  return host;
+}
+
+static inline word_t vaddr_ifetch(vaddr_t addr, int len) {
+  paddr_t paddr;
+  uint8_t *host = vaddr_host(addr, len, MEM_TYPE_IFETCH, &paddr);
+  if (likely(host != NULL)) return host_read(host, len);
+  return vaddr_ifetch_slow(addr, len);
+}
+
+static inline word_t vaddr_read(vaddr_t addr, int len) {
+  paddr_t paddr;
+  uint8_t *host = vaddr_host(addr, len, MEM_TYPE_READ, &paddr);
+  if (unlikely(host == NULL)) return vaddr_read_slow(addr, len);
+  word_t ret = host_read(host, len);
+  mtrace(paddr, len, ret, false);
+  IFDEF(CONFIG_BTRACE, if (btrace_on) btrace_mem(addr, len, ret, false));
+  return ret;
+}
+
+static inline void vaddr_write(vaddr_t addr, int len, word_t data) {
+  paddr_t paddr;
+  uint8_t *host = vaddr_host(addr, len, MEM_TYPE_WRITE, &paddr);
+  if (unlikely(host == NULL)) { vaddr_write_slow(addr, len, data); return; }
+  IFDEF(CONFIG_BTRACE, if (btrace_on) btrace_mem(addr, len, data, true));
+  mtrace(paddr, len, data, true);
+  host_write(host, len, data);
+  pmem_set_dirty(paddr);
+  pmem_check_code(paddr);
+}
+
 #endif
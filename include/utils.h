@@ -67,6 +67,39 @@ uint64_t get_time();
   } while (0) \
 )
 
+// ----------- binary trace -----------
+
+#ifdef CONFIG_BTRACE
+extern bool btrace_on;
+void btrace_inst(vaddr_t pc, const uint8_t *inst, int len);
+void btrace_mem(vaddr_t addr, int len, word_t data, bool is_write);
+void btrace_dev(const char *name, paddr_t base, paddr_t offset, int len, word_t data, bool is_write);
+bool btrace_pmem(vaddr_t pc, paddr_t addr, int len, word_t data, bool is_write);
+void btrace_close();
+#endif
+
+// ----------- memory trace -----------
+
+#ifdef CONFIG_MTRACE
+/* An access starting in [mtrace_lo, mtrace_lo + mtrace_span) may hit one
+ * of the traced ranges, and is checked by mtrace_record(). mtrace_span is
+ * 0 when mtrace is off, so the others only pay one branch.
+ */
+extern paddr_t mtrace_lo, mtrace_span;
+void mtrace_record(paddr_t addr, int len, word_t data, bool is_write);
+#define mtrace(addr, len, data, is_write) do { \
+  paddr_t __addr = (addr); \
+  if (unlikely(__addr - mtrace_lo < mtrace_span)) mtrace_record(__addr, len, data, is_write); \
+} while (0)
+
+void mtrace_set(bool enable);
+bool mtrace_add(paddr_t lo, paddr_t hi);
+void mtrace_clear();
+void mtrace_display();
+#else
+#define mtrace(addr, len, data, is_write)
+#endif
+
 #define _Log(...) \
   do { \
     printf(__VA_ARGS__); \
@@ -0,0 +1,54 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __VCAP_DEF_H__
+#define __VCAP_DEF_H__
+
+/* Format of the screen capture written by src/device/vga-capture.c and
+ * read by tools/vcap-dump.
+ *
+ * The file starts with a VCapHeader, which is followed by frames. Each
+ * frame is a VCapFrame followed by `len' bytes of runs, which change the
+ * pixels of the previous frame (all 0 before the first one) in row-major
+ * order. Pixels are 32-bit 0x00RRGGBB in the byte order of the host. A
+ * run starts with a LEB128 varint, whose lowest two bits are its type,
+ * and the other bits are the number of pixels n:
+ *
+ * VCAP_SKIP: the next n pixels are not changed.
+ * VCAP_FILL: the next n pixels are set to the pixel which follows.
+ * VCAP_COPY: the next n pixels are set to the n pixels which follow.
+ *
+ * Pixels after the last run of a frame are not changed.
+ */
+
+#include <stdint.h>
+
+#define VCAP_MAGIC "NEMUVC1"
+
+typedef struct {
+  char magic[8];
+  uint32_t width, height;
+  uint32_t fps; // the maximum number of frames per second
+  uint32_t pad;
+} VCapHeader;
+
+typedef struct {
+  uint64_t time; // in us since the capture starts
+  uint64_t len;
+} VCapFrame;
+
+enum { VCAP_SKIP, VCAP_FILL, VCAP_COPY };
+
+#endif
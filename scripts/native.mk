@@ -42,10 +42,26 @@ gdb: run-env
 	$(call git_commit, "gdb NEMU")
 	gdb -s $(BINARY) --args $(NEMU_EXEC)
 
+# Measure the simulation frequency with a generated image (riscv32 only).
+# For example, compare the results with and without CONFIG_WATCHPOINT to
+# check that watchpoints cost nothing when none is set.
+BENCH_NR_INST ?= 4000000
+BENCH_IMG := $(BUILD_DIR)/bench-$(BENCH_NR_INST).bin
+GEN_BENCH := $(NEMU_HOME)/tools/gen-bench/build/gen-bench
+
+$(GEN_BENCH):
+	@$(MAKE) -s -C $(NEMU_HOME)/tools/gen-bench
+
+$(BENCH_IMG): $(GEN_BENCH)
+	@$(GEN_BENCH) $(BENCH_NR_INST) > $@
+
+bench: $(BINARY) $(BENCH_IMG)
+	@$(BINARY) -b $(BENCH_IMG) | grep -a "frequency\|TRAP"
+
 clean-tools = $(dir $(shell find ./tools -maxdepth 2 -mindepth 2 -name "Makefile"))
 $(clean-tools):
 	-@$(MAKE) -s -C $@ clean
 clean-tools: $(clean-tools)
 clean-all: clean distclean clean-tools
 
-.PHONY: run gdb run-env clean-tools clean-all $(clean-tools)
+.PHONY: run gdb bench run-env clean-tools clean-all $(clean-tools)
@@ -17,6 +17,10 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <device/event.h>
+#include <device/map.h>
+#include <memory/tlb.h>
+#include <memory/vaddr.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -28,75 +32,145 @@
 
 CPU_state cpu = {};
 uint64_t g_nr_guest_inst = 0;
+int64_t g_stop_budget = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
-
-static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+/* Handle device events and watchpoints, then reload g_stop_budget.
+ * Return true if the CPU loop should stop.
+ */
+static bool handle_stop_request() {
+  g_stop_budget = MUXDEF(CONFIG_DEVICE, event_dispatch(), INT64_MAX);
 #ifdef CONFIG_WATCHPOINT
-  check_watchpoints();
+  // watchpoints are checked after every instruction
+  if (get_wp_head() != NULL) {
+    g_stop_budget = 1;
+    check_watchpoints();
+  }
 #endif
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) {
-    log_write("%s\n", _this->logbuf);
+  return nemu_state.state != NEMU_RUNNING;
+}
+
+#if defined(CONFIG_ENGINE_BLOCK) || defined(CONFIG_ENGINE_JIT)
+#ifdef CONFIG_ENGINE_JIT
+uint64_t jit_exec(uint64_t n);
+void jit_statistic();
+#define engine_exec jit_exec
+#else
+uint64_t block_exec(uint64_t n);
+void block_statistic();
+#define engine_exec block_exec
+#endif
+
+/* Run basic blocks. The monitor only regains control at block boundaries. */
+static void execute(uint64_t n) {
+  if (handle_stop_request()) return;
+  while (n > 0) {
+    uint64_t nr = engine_exec(n < (uint64_t)g_stop_budget ? n : g_stop_budget);
+    g_nr_guest_inst += nr;
+    n -= nr;
+    g_stop_budget -= nr;
+    if (g_stop_budget <= 0 && handle_stop_request()) break;
   }
+}
+#else
+static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+#ifdef CONFIG_ITRACE
+  // only format the instruction when it is output
+  bool to_log = false;
+#ifdef CONFIG_ITRACE_COND
+  extern bool log_enable();
+  to_log = ITRACE_COND && log_enable();
 #endif
-  if (g_print_step) {
-    IFDEF(CONFIG_ITRACE, puts(_this->logbuf));
+  if (to_log || g_print_step) {
+    ITraceRecord r;
+    char buf[128];
+    itrace_capture(&r, _this);
+    itrace_format(buf, sizeof(buf), &r);
+    if (to_log) log_write("%s\n", buf);
+    if (g_print_step) puts(buf);
   }
+#endif
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
 }
 
+#ifdef CONFIG_DECODE_CACHE
+#define DECODE_CACHE_SIZE CONFIG_DECODE_CACHE_SIZE
+static_assert((DECODE_CACHE_SIZE & (DECODE_CACHE_SIZE - 1)) == 0,
+    "DECODE_CACHE_SIZE must be a power of 2");
+
+static Decode decode_cache[DECODE_CACHE_SIZE] = {};
+// the physical page of each entry
+static paddr_t decode_cache_page[DECODE_CACHE_SIZE] = {};
+static uint64_t g_decode_cache_hit = 0;
+static uint64_t g_decode_cache_miss = 0;
+
+// called by pmem_code_written()
+static void decode_cache_invalidate(paddr_t page) {
+  for (int i = 0; i < DECODE_CACHE_SIZE; i ++) {
+    if (decode_cache_page[i] == page) decode_cache[i].handler = NULL;
+  }
+}
+
+// Return the cache entry for `pc`. On a miss the entry is reset,
+// and isa_exec_once() will fetch and decode the instruction into it.
+static Decode *decode_cache_lookup(vaddr_t pc) {
+  // Entries are looked up by the virtual address, which may be mapped to
+  // other code after satp is written, so nothing is cached with the MMU on.
+  if (unlikely(isa_mmu_check(pc, 4, MEM_TYPE_IFETCH) != MMU_DIRECT)) {
+    static Decode uncached;
+    uncached.pc = pc;
+    uncached.snpc = pc;
+    uncached.handler = NULL;
+    return &uncached;
+  }
+  int idx = (pc >> 2) & (DECODE_CACHE_SIZE - 1);
+  Decode *s = &decode_cache[idx];
+  if (likely(s->handler != NULL && s->pc == pc)) {
+    g_decode_cache_hit ++;
+    return s;
+  }
+  static bool init = false;
+  if (unlikely(!init)) {
+    pmem_add_code_callback(decode_cache_invalidate);
+    init = true;
+  }
+  g_decode_cache_miss ++;
+  decode_cache_page[idx] = vaddr_mark_code(pc) & ~(paddr_t)PAGE_MASK;
+  s->pc = pc;
+  s->snpc = pc;
+  s->handler = NULL;
+  return s;
+}
+#endif
+
 static void exec_once(Decode *s, vaddr_t pc) {
+#ifndef CONFIG_DECODE_CACHE
   s->pc = pc;
   s->snpc = pc;
+#endif
   isa_exec_once(s);
   cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst;
-#ifdef CONFIG_ISA_x86
-  for (i = 0; i < ilen; i++) {
-#else
-  for (i = ilen - 1; i >= 0; i--) {
-#endif
-    p += snprintf(p, 4, " %02x", inst[i]);
-  }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0)
-    space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
-
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-              MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst,
-              ilen);
-#endif
+  IFDEF(CONFIG_IRINGBUF, iringbuf_push(s));
+  IFDEF(CONFIG_BTRACE, if (btrace_on) btrace_inst(s->pc, (uint8_t *)&s->isa.inst, s->snpc - s->pc));
 }
 
 static void execute(uint64_t n) {
-  Decode s;
+#ifndef CONFIG_DECODE_CACHE
+  Decode decode_buf;
+  Decode *s = &decode_buf;
+#endif
+  if (handle_stop_request()) return;
   for (; n > 0; n--) {
-    exec_once(&s, cpu.pc);
+    IFDEF(CONFIG_DECODE_CACHE, Decode *s = decode_cache_lookup(cpu.pc));
+    exec_once(s, cpu.pc);
     g_nr_guest_inst++;
-    trace_and_difftest(&s, cpu.pc);
-    if (check_watchpoints()) {
-      nemu_state.state = NEMU_STOP;
-      break;
-    }
-
-    if (nemu_state.state != NEMU_RUNNING)
+    trace_and_difftest(s, cpu.pc);
+    if (unlikely(-- g_stop_budget <= 0) && handle_stop_request())
       break;
-    IFDEF(CONFIG_DEVICE, device_update());
   }
 }
+#endif
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
@@ -109,9 +183,17 @@ static void statistic() {
   else
     Log("Finish running in less than 1 us and can not calculate the simulation "
         "frequency");
+  IFDEF(CONFIG_DECODE_CACHE, Log("decode cache hit = " NUMBERIC_FMT
+        ", miss = " NUMBERIC_FMT, g_decode_cache_hit, g_decode_cache_miss));
+  IFDEF(CONFIG_MODE_SYSTEM, tlb_statistic());
+  IFDEF(CONFIG_ENGINE_BLOCK, block_statistic());
+  IFDEF(CONFIG_ENGINE_JIT, jit_statistic());
+  IFDEF(CONFIG_DEVICE, map_statistic());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_BTRACE, btrace_close());
+  IFDEF(CONFIG_IRINGBUF, iringbuf_dump());
   isa_reg_display();
   statistic();
 }
@@ -151,6 +233,7 @@ void cpu_exec(uint64_t n) {
                     ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN)
                     : ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
         nemu_state.halt_pc);
+    IFDEF(CONFIG_IRINGBUF, if (nemu_state.state == NEMU_ABORT) iringbuf_dump());
     // fall through
   case NEMU_QUIT:
     statistic();
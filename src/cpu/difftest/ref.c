@@ -19,7 +19,8 @@
 #include <memory/paddr.h>
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) paddr_write_bulk(addr, buf, n);
+  else paddr_read_bulk(addr, buf, n);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
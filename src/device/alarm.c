@@ -36,6 +36,8 @@ static void alarm_sig_handler(int signum) {
 }
 
 void init_alarm() {
+  if (idx == 0) return; // no one needs the timer signal
+
   struct sigaction s;
   memset(&s, 0, sizeof(s));
   s.sa_handler = alarm_sig_handler;
@@ -16,6 +16,8 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/event.h>
+#include <cpu/cpu.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -31,24 +33,23 @@ void init_sdcard();
 void init_alarm();
 
 void send_key(uint8_t, bool);
-void vga_update_screen();
-
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
-
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
 #ifndef CONFIG_TARGET_AM
+// With the presenter thread of VGA, events are pumped by it, and only
+// taken out of the queue here.
+#ifdef CONFIG_VGA_PRESENT_THREAD
+#define sdl_get_event(e) (SDL_PeepEvents(e, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0)
+#else
+#define sdl_get_event(e) SDL_PollEvent(e)
+#endif
+
+static void sdl_poll_event() {
   SDL_Event event;
-  while (SDL_PollEvent(&event)) {
+  while (sdl_get_event(&event)) {
     switch (event.type) {
       case SDL_QUIT:
         nemu_state.state = NEMU_QUIT;
+        cpu_request_stop();
         break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
@@ -63,13 +64,13 @@ void device_update() {
       default: break;
     }
   }
-#endif
 }
+#endif
 
 void sdl_clear_event_queue() {
 #ifndef CONFIG_TARGET_AM
   SDL_Event event;
-  while (SDL_PollEvent(&event));
+  while (sdl_get_event(&event));
 #endif
 }
 
@@ -85,5 +86,7 @@ void init_device() {
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
 
+  IFNDEF(CONFIG_TARGET_AM, add_event(sdl_poll_event, 0, 1000000 / TIMER_HZ));
+
   IFNDEF(CONFIG_TARGET_AM, init_alarm());
 }
@@ -0,0 +1,102 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/event.h>
+#include <cpu/cpu.h>
+#include <utils.h>
+
+#define MAX_EVENT 16
+// bounds of the number of guest instructions between two dispatches
+#define MIN_SLICE 256
+#define MAX_SLICE (1 << 20)
+
+typedef struct {
+  uint64_t deadline; // unit: us
+  uint64_t period;
+  event_handler_t handler;
+} Event;
+
+// a min-heap of pending events ordered by deadline
+static Event heap[MAX_EVENT] = {};
+static int nr_event = 0;
+
+static int64_t slice = 1;
+static uint64_t last_time = 0;
+static uint64_t last_inst = 0;
+
+extern uint64_t g_nr_guest_inst;
+
+static void heap_push(Event e) {
+  assert(nr_event < MAX_EVENT);
+  int i = nr_event ++;
+  while (i > 0 && heap[(i - 1) / 2].deadline > e.deadline) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = e;
+}
+
+static Event heap_pop() {
+  Event top = heap[0];
+  Event last = heap[-- nr_event];
+  int i = 0;
+  while (2 * i + 1 < nr_event) {
+    int child = 2 * i + 1;
+    if (child + 1 < nr_event && heap[child + 1].deadline < heap[child].deadline) child ++;
+    if (heap[child].deadline >= last.deadline) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return top;
+}
+
+void add_event(event_handler_t h, uint64_t delay, uint64_t period) {
+  heap_push((Event) { .deadline = get_time() + delay, .period = period, .handler = h });
+  // make the new event take effect in the next dispatch
+  cpu_request_stop();
+}
+
+/* Call the handlers of expired events, then estimate how many guest
+ * instructions can run before the next deadline from the speed measured
+ * since the last dispatch. This is the only place of the CPU loop which
+ * reads the host time.
+ */
+int64_t event_dispatch() {
+  uint64_t now = get_time();
+  while (nr_event > 0 && heap[0].deadline <= now) {
+    Event e = heap_pop();
+    if (e.period != 0) {
+      // do not try to catch up with missed periods
+      e.deadline = (e.deadline + e.period > now ? e.deadline + e.period : now + e.period);
+      heap_push(e);
+    }
+    e.handler();
+  }
+
+  uint64_t inst = g_nr_guest_inst - last_inst;
+  uint64_t us = now - last_time;
+  last_inst = g_nr_guest_inst;
+  last_time = now;
+
+  int64_t n = MAX_SLICE;
+  if (nr_event > 0) {
+    n = (us == 0 ? slice * 2 : (heap[0].deadline - now) * inst / us);
+  }
+  if (n < MIN_SLICE) n = MIN_SLICE;
+  if (n > MAX_SLICE) n = MAX_SLICE;
+  slice = n;
+  return n;
+}
@@ -18,18 +18,64 @@
 #include <memory/vaddr.h>
 #include <device/map.h>
 
+#ifndef CONFIG_TARGET_AM
+#include <sys/mman.h>
+#endif
+
 #define IO_SPACE_MAX (32 * 1024 * 1024)
+#define LARGE_SPACE_ALIGN (2 * 1024 * 1024)
+#define NR_SPACE 16
 
+/* The backing space of device registers is carved from a range of
+ * IO_SPACE_MAX bytes reserved by init_map(). It is made accessible by
+ * new_space() piece by piece, and the host commits a page on its first
+ * access, so only the pages used by devices take memory.
+ */
 static uint8_t *io_space = NULL;
 static uint8_t *p_space = NULL;
 
-uint8_t* new_space(int size) {
+typedef struct {
+  const char *name;
+  uint8_t *space;
+  size_t size;
+} IOSpace;
+
+// for map_statistic()
+static IOSpace spaces[NR_SPACE] = {};
+static int nr_space = 0;
+
+static uint8_t *add_space(const char *name, uint8_t *p, size_t size) {
+  Assert(nr_space < NR_SPACE, "too many device spaces");
+  spaces[nr_space ++] = (IOSpace){ .name = name, .space = p, .size = size };
+  return p;
+}
+
+uint8_t* new_space(const char *name, int size) {
   uint8_t *p = p_space;
   // page aligned;
   size = (size + (PAGE_SIZE - 1)) & ~PAGE_MASK;
   p_space += size;
-  assert(p_space - io_space < IO_SPACE_MAX);
-  return p;
+  Assert(p_space - io_space <= IO_SPACE_MAX, "no more space for device %s", name);
+  IFNDEF(CONFIG_TARGET_AM, Assert(mprotect(p, size, PROT_READ | PROT_WRITE) == 0,
+        "can not commit the space for device %s", name));
+  return add_space(name, p, size);
+}
+
+uint8_t* new_large_space(const char *name, int size) {
+#ifdef CONFIG_TARGET_AM
+  return new_space(name, size);
+#else
+  // a mapping of its own, aligned for huge pages
+  size_t len = ROUNDUP(size, LARGE_SPACE_ALIGN);
+  uint8_t *p = mmap(NULL, len + LARGE_SPACE_ALIGN, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(p != MAP_FAILED, "can not map the space for device %s", name);
+  p = (uint8_t *)ROUNDUP(p, LARGE_SPACE_ALIGN);
+#ifdef MADV_HUGEPAGE
+  madvise(p, len, MADV_HUGEPAGE);
+#endif
+  return add_space(name, p, len);
+#endif
 }
 
 static void check_bound(IOMap *map, paddr_t addr) {
@@ -47,24 +93,91 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
 }
 
 void init_map() {
+#ifdef CONFIG_TARGET_AM
   io_space = malloc(IO_SPACE_MAX);
   assert(io_space);
+#else
+  io_space = mmap(NULL, IO_SPACE_MAX, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(io_space != MAP_FAILED, "can not reserve the space for devices");
+#endif
   p_space = io_space;
 }
 
+// Report the size of the space of each device, and how much of it is resident.
+void map_statistic() {
+#ifndef CONFIG_TARGET_AM
+  for (int i = 0; i < nr_space; i ++) {
+    size_t nr_page = spaces[i].size / PAGE_SIZE, resident = 0;
+    unsigned char vec[256];
+    for (size_t j = 0; j < nr_page; j += ARRLEN(vec)) {
+      size_t n = (nr_page - j < ARRLEN(vec) ? nr_page - j : ARRLEN(vec));
+      if (mincore(spaces[i].space + j * PAGE_SIZE, n * PAGE_SIZE, vec) != 0) break;
+      for (size_t k = 0; k < n; k ++) resident += vec[k] & 1;
+    }
+    Log("device space '%s': %zu KB, resident %zu KB", spaces[i].name,
+        spaces[i].size >> 10, resident * PAGE_SIZE >> 10);
+  }
+#endif
+}
+
+#define IOMAP_PAGE_SIZE (1 << PMEM_PAGE_SHIFT)
+
+// fill the bytes of `map' in the page at `page' with `id'
+static void fill_ids(uint16_t *ids, paddr_t page, const IOMap *map, uint16_t id) {
+  paddr_t lo = (map->low > page ? map->low : page);
+  paddr_t hi = (map->high < page + IOMAP_PAGE_SIZE - 1 ? map->high : page + IOMAP_PAGE_SIZE - 1);
+  for (paddr_t a = lo; a - lo <= hi - lo; a ++) ids[a - page] = id;
+}
+
+IOMap* map_table_add(IOMapTable *t, const IOMap *map) {
+  Assert(t->nr_map < UINT16_MAX, "too many maps");
+  IOMap *m = malloc(sizeof(*m));
+  t->maps = realloc(t->maps, (t->nr_map + 1) * sizeof(t->maps[0]));
+  assert(m != NULL && t->maps != NULL);
+  *m = *map;
+  t->maps[t->nr_map ++] = m;
+
+  for (uint64_t p = m->low >> PMEM_PAGE_SHIFT; p <= m->high >> PMEM_PAGE_SHIFT; p ++) {
+    paddr_t page = p << PMEM_PAGE_SHIFT;
+    uintptr_t **pt = &t->dir[page >> IOMAP_DIR_SHIFT];
+    if (*pt == NULL) {
+      *pt = calloc(1 << (IOMAP_DIR_SHIFT - PMEM_PAGE_SHIFT), sizeof(uintptr_t));
+      assert(*pt != NULL);
+    }
+    uintptr_t *e = &(*pt)[BITS(page, IOMAP_DIR_SHIFT - 1, PMEM_PAGE_SHIFT)];
+    if (*e == 0) { *e = (uintptr_t)m; continue; }
+    if ((*e & 1) == 0) {
+      // the second map in the page
+      IOMap *other = (IOMap *)*e;
+      uint16_t *ids = calloc(IOMAP_PAGE_SIZE, sizeof(uint16_t));
+      assert(ids != NULL);
+      int i;
+      for (i = 0; t->maps[i] != other; i ++) ;
+      fill_ids(ids, page, other, i + 1);
+      *e = (uintptr_t)ids | 1;
+    }
+    fill_ids((uint16_t *)(*e - 1), page, m, t->nr_map);
+  }
+  return m;
+}
+
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
   paddr_t offset = addr - map->low;
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  IFDEF(CONFIG_BTRACE, if (btrace_on) btrace_dev(map->name, map->low, offset, len, ret, false));
   return ret;
 }
 
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_BTRACE, if (btrace_on) btrace_dev(map->name, map->low, offset, len, data, true));
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
 }
@@ -16,14 +16,10 @@
 #include <device/map.h>
 #include <memory/paddr.h>
 
-#define NR_MAP 16
-
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+static IOMapTable mmio_table = {};
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  return map_table_find(&mmio_table, addr);
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -33,24 +29,31 @@ static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
 }
 
 /* device interface */
-void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
+void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback, bool passive) {
   paddr_t left = addr, right = addr + len - 1;
   if (in_pmem(left) || in_pmem(right)) {
     report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
   }
-  for (int i = 0; i < nr_map; i++) {
-    if (left <= maps[i].high && right >= maps[i].low) {
-      report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
+  for (int i = 0; i < mmio_table.nr_map; i++) {
+    IOMap *map = mmio_table.maps[i];
+    if (left <= map->high && right >= map->low) {
+      report_mmio_overlap(name, left, right, map->name, map->low, map->high);
     }
   }
 
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
-  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
+  IOMap *map = map_table_add(&mmio_table, &(IOMap){ .name = name, .low = addr,
+      .high = addr + len - 1, .space = space, .callback = callback });
+  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]%s", map->name, map->low, map->high,
+      (passive ? " (passive)" : ""));
 
-  nr_map ++;
+  // Accesses to a passive map are not skipped by DiffTest, and a space
+  // which is not page aligned (e.g. allocated by malloc() on AM) can not
+  // be a region, so the map is accessed through mmio_read() and mmio_write().
+  if (passive && !ISDEF(CONFIG_DIFFTEST) &&
+      ((addr | (uintptr_t)space) & BITMASK(PMEM_PAGE_SHIFT)) == 0) {
+    Assert(callback == NULL, "passive map '%s' should not have a callback", name);
+    pmem_add_device_region(addr, len, space);
+  }
 }
 
 /* bus interface */
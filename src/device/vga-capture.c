@@ -0,0 +1,212 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <common.h>
+#include <utils.h>
+#include <vcap-def.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* With --vga-capture, the screen is written to a file instead of shown
+ * with SDL. On a sync, the rows of vmem changed since the last captured
+ * frame are copied to one of NR_BUF buffers, which is handed over to the
+ * writer thread like src/utils/btrace.c does. The writer encodes the
+ * difference from the previous frame (see include/vcap-def.h).
+ *
+ * At most VGA_CAPTURE_FPS frames are captured per second. A frame is
+ * also dropped if all the buffers are full, so the CPU thread does not
+ * wait. The rows changed in dropped frames are kept in `pending', and
+ * are copied with the next captured frame.
+ */
+#define NR_BUF 4
+#define FRAME_PERIOD (1000000 / CONFIG_VGA_CAPTURE_FPS)
+
+typedef struct {
+  uint32_t *pixels;
+  uint8_t *damage; // rows changed since the previous frame
+  uint64_t time;
+  atomic_bool full;
+} VCapBuf;
+
+static VCapBuf vcap_buf[NR_BUF] = {};
+static int vcap_cur = 0;
+static uint8_t *pending = NULL;
+static bool vcap_changed = false;
+static uint64_t vcap_start = 0;
+static uint64_t vcap_last = 0;
+
+static const char *vcap_file = NULL;
+static FILE *vcap_fp = NULL;
+static const uint32_t *vcap_vmem = NULL;
+static int vcap_w = 0, vcap_h = 0;
+static pthread_t vcap_thread;
+static atomic_bool vcap_exit = false;
+
+// only used by the writer thread
+static uint32_t *vcap_prev = NULL;
+static uint8_t *vcap_out = NULL;
+static uint64_t g_vcap_frame = 0;
+static uint64_t g_vcap_size = 0;
+
+static inline uint8_t *put_u(uint8_t *p, uint64_t x) {
+  while (x >= 0x80) {
+    *p ++ = (x & 0x7f) | 0x80;
+    x >>= 7;
+  }
+  *p ++ = x;
+  return p;
+}
+
+static inline uint8_t *put_run(uint8_t *p, int type, uint64_t n) {
+  return put_u(p, (n << 2) | type);
+}
+
+// Encode the changed rows of `b' into vcap_out, and return its length.
+static size_t vcap_encode(VCapBuf *b) {
+  uint8_t *p = vcap_out;
+  uint64_t skip = 0;
+  for (int y = 0; y < vcap_h; y ++) {
+    if (!b->damage[y]) { skip += vcap_w; continue; }
+    const uint32_t *cur = b->pixels + y * vcap_w;
+    uint32_t *prev = vcap_prev + y * vcap_w;
+    int x = 0;
+    while (x < vcap_w) {
+      if (cur[x] == prev[x]) { skip ++; x ++; continue; }
+      if (skip > 0) { p = put_run(p, VCAP_SKIP, skip); skip = 0; }
+      int n = 1;
+      while (x + n < vcap_w && cur[x + n] == cur[x]) n ++;
+      if (n > 1) {
+        p = put_run(p, VCAP_FILL, n);
+        memcpy(p, &cur[x], sizeof(uint32_t));
+        p += sizeof(uint32_t);
+      } else {
+        // stop before an unchanged pixel or a run of the same pixels
+        while (x + n < vcap_w && cur[x + n] != prev[x + n] &&
+            !(x + n + 1 < vcap_w && cur[x + n + 1] == cur[x + n])) n ++;
+        p = put_run(p, VCAP_COPY, n);
+        memcpy(p, &cur[x], n * sizeof(uint32_t));
+        p += n * sizeof(uint32_t);
+      }
+      x += n;
+    }
+    memcpy(prev, cur, vcap_w * sizeof(uint32_t));
+  }
+  return p - vcap_out;
+}
+
+static void *vcap_writer(void *arg) {
+  int i = 0;
+  while (true) {
+    // load the flag first, frames submitted before exiting are still written
+    bool exiting = atomic_load(&vcap_exit);
+    VCapBuf *b = &vcap_buf[i];
+    if (atomic_load(&b->full)) {
+      VCapFrame f = { .time = b->time, .len = vcap_encode(b) };
+      fwrite(&f, sizeof(f), 1, vcap_fp);
+      fwrite(vcap_out, 1, f.len, vcap_fp);
+      g_vcap_frame ++;
+      g_vcap_size += sizeof(f) + f.len;
+      atomic_store(&b->full, false);
+      i = (i + 1) % NR_BUF;
+    } else if (exiting) {
+      break;
+    } else {
+      usleep(1000);
+    }
+  }
+  return NULL;
+}
+
+// Copy the pending rows to a free buffer and submit it. Return false if
+// there is no free buffer and `wait' is false.
+static bool vcap_submit(uint64_t now, bool wait) {
+  VCapBuf *b = &vcap_buf[vcap_cur];
+  while (atomic_load(&b->full)) {
+    if (!wait) return false;
+    sched_yield();
+  }
+  for (int y = 0; y < vcap_h; y ++) {
+    b->damage[y] = pending[y];
+    if (pending[y]) memcpy(b->pixels + y * vcap_w, vcap_vmem + y * vcap_w, vcap_w * sizeof(uint32_t));
+  }
+  memset(pending, 0, vcap_h);
+  vcap_changed = false;
+  b->time = now - vcap_start;
+  atomic_store(&b->full, true);
+  vcap_cur = (vcap_cur + 1) % NR_BUF;
+  vcap_last = now;
+  return true;
+}
+
+void vga_capture_rows(int y, int h) {
+  memset(&pending[y], 1, h);
+  vcap_changed = true;
+}
+
+void vga_capture_frame() {
+  if (!vcap_changed) return;
+  uint64_t now = get_time();
+  if (vcap_last != 0 && now - vcap_last < FRAME_PERIOD) return;
+  vcap_submit(now, false);
+}
+
+static void vga_capture_close() {
+  if (vcap_fp == NULL) return;
+  if (vcap_changed) vcap_submit(get_time(), true);
+  atomic_store(&vcap_exit, true);
+  pthread_join(vcap_thread, NULL);
+  fclose(vcap_fp);
+  vcap_fp = NULL;
+  Log("VGA capture: %" PRIu64 " frames, %" PRIu64 " bytes", g_vcap_frame, g_vcap_size);
+}
+
+// Return false if no file is given by --vga-capture.
+bool vga_capture_start(const uint32_t *vmem, int w, int h) {
+  if (vcap_file == NULL) return false;
+  vcap_fp = fopen(vcap_file, "wb");
+  Assert(vcap_fp, "Can not open '%s'", vcap_file);
+  vcap_vmem = vmem;
+  vcap_w = w;
+  vcap_h = h;
+
+  VCapHeader hdr = { .width = w, .height = h, .fps = CONFIG_VGA_CAPTURE_FPS };
+  strcpy(hdr.magic, VCAP_MAGIC);
+  fwrite(&hdr, sizeof(hdr), 1, vcap_fp);
+
+  for (int i = 0; i < NR_BUF; i ++) {
+    vcap_buf[i].pixels = malloc(w * h * sizeof(uint32_t));
+    vcap_buf[i].damage = malloc(h);
+    assert(vcap_buf[i].pixels && vcap_buf[i].damage);
+  }
+  pending = calloc(h, 1);
+  vcap_prev = calloc(w * h, sizeof(uint32_t));
+  // at most a pixel and the varint of a run for each pixel
+  vcap_out = malloc((size_t)w * h * (sizeof(uint32_t) + 8));
+  assert(pending && vcap_prev && vcap_out);
+
+  vcap_start = get_time();
+  int ret = pthread_create(&vcap_thread, NULL, vcap_writer, NULL);
+  Assert(ret == 0, "Can not create the thread to write the screen capture");
+  atexit(vga_capture_close);
+  Log("Screen is captured to %s", vcap_file);
+  return true;
+}
+
+void init_vga_capture(const char *file) {
+  vcap_file = file;
+}
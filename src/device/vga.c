@@ -15,6 +15,8 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/alarm.h>
+#include <device/event.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -34,6 +36,16 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+#ifdef CONFIG_VGA_CAPTURE
+// set if the screen is captured to a file, see vga-capture.c
+static bool vga_capture = false;
+bool vga_capture_start(const uint32_t *vmem, int w, int h);
+void vga_capture_rows(int y, int h);
+void vga_capture_frame();
+#else
+#define vga_capture false
+#endif
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
@@ -41,7 +53,7 @@ static uint32_t *vgactl_port_base = NULL;
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
+static void sdl_init_screen() {
   SDL_Window *window = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
@@ -56,37 +68,199 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+// upload the rows [y, y + h) of a frame to the texture
+static void sdl_update_rows(const uint32_t *pixels, int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, pixels + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static void sdl_present() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+#ifdef CONFIG_VGA_PRESENT_THREAD
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* SDL is only used by the presenter thread, so the CPU thread never waits
+ * for SDL_RenderPresent(). On each sync, the CPU thread copies vmem to the
+ * frame it owns (`back'), and swaps it with the one in `slot', which is
+ * marked FRAME_NEW. The presenter takes a new frame from `slot' by leaving
+ * the one it has shown there. Neither thread waits for the other, and a
+ * frame not taken before the next sync is dropped.
+ */
+#define NR_FRAME 3
+#define FRAME_NEW 0x4
+
+typedef struct {
+  uint32_t pixels[SCREEN_W * SCREEN_H];
+  uint8_t damage[SCREEN_H]; // rows changed since the previous frame
+  uint8_t stale[SCREEN_H];  // rows older than vmem, only used by the CPU thread
+  uint64_t seq;
+} Frame;
+
+static Frame frame[NR_FRAME] = {};
+static int back = 0;
+static atomic_int slot = 1;
+static uint64_t frame_seq = 0;
+static pthread_t present_thread;
+static atomic_bool present_exit = false;
+
+static void *vga_presenter(void *arg) {
+  sdl_init_screen();
+  int front = 2;
+  uint64_t seq = 0;
+  while (!atomic_load(&present_exit)) {
+    // events are read by sdl_poll_event() in the CPU thread
+    SDL_PumpEvents();
+    if (!(atomic_load(&slot) & FRAME_NEW)) {
+      usleep(1000);
+      continue;
+    }
+    front = atomic_exchange(&slot, front) & ~FRAME_NEW;
+    Frame *f = &frame[front];
+    // the damage of dropped frames is unknown, upload the whole frame then
+    bool all = (f->seq != seq + 1);
+    seq = f->seq;
+    for (int y = 0; y < SCREEN_H; ) {
+      if (!all && !f->damage[y]) { y ++; continue; }
+      int y0 = y;
+      while (y < SCREEN_H && (all || f->damage[y])) y ++;
+      sdl_update_rows(f->pixels, y0, y - y0);
+    }
+    sdl_present();
+  }
+  return NULL;
+}
+
+static void vga_close() {
+  atomic_store(&present_exit, true);
+  pthread_join(present_thread, NULL);
+}
+
+static void init_screen() {
+  int ret = pthread_create(&present_thread, NULL, vga_presenter, NULL);
+  Assert(ret == 0, "Can not create the thread to present the screen");
+  atexit(vga_close);
+}
+
+static inline void update_rows(int y, int h) {
+  memset(&frame[back].damage[y], 1, h);
+}
+
+static inline void update_screen() {
+  Frame *f = &frame[back];
+  for (int y = 0; y < SCREEN_H; y ++) {
+    if (f->damage[y]) {
+      for (int i = 0; i < NR_FRAME; i ++) frame[i].stale[y] = 1;
+    }
+    if (f->stale[y]) {
+      memcpy(&f->pixels[y * SCREEN_W], (uint32_t *)vmem + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+      f->stale[y] = 0;
+    }
+  }
+  f->seq = ++ frame_seq;
+  back = atomic_exchange(&slot, back | FRAME_NEW) & ~FRAME_NEW;
+  memset(frame[back].damage, 0, SCREEN_H);
+}
+#else
+static void init_screen() { sdl_init_screen(); }
+static inline void update_rows(int y, int h) { sdl_update_rows(vmem, y, h); }
+static inline void update_screen() { sdl_present(); }
+#endif
 #else
 static void init_screen() {}
 
+static inline void update_rows(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint32_t *)vmem + y * screen_width(), screen_width(), h, false);
+}
+
 static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
+#endif
+
+#endif
+
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+/* Only the rows of vmem written since the last sync are uploaded, and the
+ * frame is skipped if there is none. They are found with the dirty flags
+ * of pmem, so the whole screen is uploaded on each sync if vmem is not a
+ * region of pmem (see add_mmio_map()), or the flags are not tracked.
+ */
+static bool vga_dirty_tracked = false;
+static bool vga_full_update = true;
+static bool vga_changed = false;
+
+// the rows [y, y + h) of vmem are changed
+static void damage_rows(int y, int h) {
+#ifdef CONFIG_VGA_CAPTURE
+  if (vga_capture) { vga_capture_rows(y, h); return; }
+#endif
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, update_rows(y, h));
+}
+
+static void update_dirty_rows(paddr_t addr, uint64_t len) {
+  uint32_t pitch = screen_width() * sizeof(uint32_t);
+  uint64_t start = addr - CONFIG_FB_ADDR, end = start + len;
+  int y0 = start / pitch;
+  int y1 = (end + pitch - 1) / pitch;
+  if (y1 > screen_height()) y1 = screen_height();
+  if (y0 < y1) damage_rows(y0, y1 - y0);
+  vga_changed = true;
 }
+
+static void vga_sync() {
+  if (vga_dirty_tracked && !vga_full_update) {
+    vga_changed = false;
+    pmem_dirty_scan_range(CONFIG_FB_ADDR, screen_size(), update_dirty_rows, true);
+    if (!vga_changed) return;
+  } else {
+    if (vga_dirty_tracked) pmem_dirty_scan_range(CONFIG_FB_ADDR, screen_size(), NULL, true);
+    damage_rows(0, screen_height());
+    vga_full_update = false;
+  }
+#ifdef CONFIG_VGA_CAPTURE
+  if (vga_capture) { vga_capture_frame(); return; }
 #endif
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+}
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[1] != 0) {
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+    vga_sync();
+#endif
+    vgactl_port_base[1] = 0;
+  }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
+  vgactl_port_base = (uint32_t *)new_space("vgactl", 8);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
   add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL, false);
 #endif
 
-  vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  vmem = new_large_space("vmem", screen_size());
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL, true);
+#ifdef CONFIG_VGA_CAPTURE
+  vga_capture = vga_capture_start(vmem, screen_width(), screen_height());
+  // handle the last sync before the capture is closed, since it is
+  // usually the final screen of the guest
+  if (vga_capture) atexit(vga_update_screen);
+#endif
+  // SDL is not initialized if the screen is captured
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, if (!vga_capture) init_screen());
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+  memset(vmem, 0, screen_size());
+  vga_dirty_tracked = ISDEF(CONFIG_PMEM_DIRTY) && in_pmem(CONFIG_FB_ADDR);
+#endif
+  add_event(vga_update_screen, 0, 1000000 / TIMER_HZ);
 }
@@ -0,0 +1,135 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <memory/vaddr.h>
+
+#define NR_BLOCK 1024
+#define BLOCK_MAX_INST 32
+
+typedef struct {
+  vaddr_t pc;
+  int nr_inst; // 0 if the entry is not valid
+  paddr_t page[2]; // the physical pages of the first and the last instruction
+  // the last valid instruction is followed by an entry without handler
+  Decode inst[BLOCK_MAX_INST + 1];
+} Block;
+
+static Block block_cache[NR_BLOCK] = {};
+static uint64_t g_block_hit = 0;
+static uint64_t g_block_miss = 0;
+
+static Block *block_lookup(vaddr_t pc) {
+  return &block_cache[(pc >> 2) & (NR_BLOCK - 1)];
+}
+
+/* Called by pmem_code_written(). Clearing the handlers also stops a block
+ * running with threaded code after the current instruction, and tells
+ * block_build() not to keep the block it is building.
+ */
+static void block_invalidate(paddr_t page) {
+  for (int i = 0; i < NR_BLOCK; i ++) {
+    Block *b = &block_cache[i];
+    if (b->page[0] != page && b->page[1] != page) continue;
+    b->nr_inst = 0;
+    for (int j = 0; j <= BLOCK_MAX_INST; j ++) b->inst[j].handler = NULL;
+  }
+}
+
+/* Execute and record instructions one by one, until an instruction
+ * transfers control or stops NEMU. At most `n` instructions are
+ * executed. Return the number of executed instructions.
+ */
+static int block_build(Block *b, vaddr_t pc, int n) {
+  int i;
+  b->pc = pc;
+  b->nr_inst = 0;
+  b->page[0] = b->page[1] = vaddr_mark_code(pc) & ~(paddr_t)PAGE_MASK;
+  for (i = 0; i < n; i ++) {
+    Decode *s = &b->inst[i];
+    if (i > 0 && (cpu.pc & PAGE_MASK) == 0) b->page[1] = vaddr_mark_code(cpu.pc) & ~(paddr_t)PAGE_MASK;
+    s->pc = cpu.pc;
+    s->snpc = cpu.pc;
+    s->handler = NULL;
+    s[1].handler = NULL; // only execute this instruction
+    isa_exec_once(s);
+    cpu.pc = s->dnpc;
+    if (s->dnpc != s->snpc || nemu_state.state != NEMU_RUNNING) { i ++; break; }
+  }
+
+  // A block cut short by `n` is not complete, do not keep it. Neither is
+  // a block which has written to its own code.
+  if (b->inst[0].handler == NULL) return i;
+  if (i == BLOCK_MAX_INST || b->inst[i - 1].dnpc != b->inst[i - 1].snpc ||
+      nemu_state.state != NEMU_RUNNING) {
+    b->nr_inst = i;
+  }
+  return i;
+}
+
+/* Execute at most `n` instructions starting from cpu.pc, and stop at the
+ * end of a basic block. Return the number of executed instructions.
+ */
+uint64_t block_exec(uint64_t n) {
+  // Blocks are looked up by the virtual address, which may be mapped to
+  // other code after satp is written, so nothing is cached with the MMU on.
+  if (unlikely(isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH) != MMU_DIRECT)) {
+    Decode s[2] = {};
+    s[0].pc = cpu.pc;
+    s[0].snpc = cpu.pc;
+    isa_exec_once(&s[0]);
+    cpu.pc = s[0].dnpc;
+    return 1;
+  }
+
+  Block *b = block_lookup(cpu.pc);
+  if (likely(b->nr_inst != 0 && b->pc == cpu.pc)) {
+    g_block_hit ++;
+    // cpu.pc is only updated at the end of the threaded code, so execute
+    // the block one by one when mtrace records the pc of each access
+    if (likely(b->nr_inst <= n) && MUXDEF(CONFIG_MTRACE, mtrace_span == 0, true)) {
+      int nr = isa_exec_once(&b->inst[0]);
+      cpu.pc = b->inst[nr - 1].dnpc;
+      return nr;
+    }
+
+    // Fewer instructions are requested than the block has (e.g. by `si'),
+    // or mtrace is on, execute them one by one and keep the block. Stop at
+    // the end of the block, or when it is invalidated (nr_inst is set to
+    // 0), and let the next call look up the following block.
+    Decode s[2] = {};
+    uint64_t i;
+    for (i = 0; i < n && i < b->nr_inst && nemu_state.state == NEMU_RUNNING; i ++) {
+      s[0] = b->inst[i];
+      isa_exec_once(&s[0]);
+      cpu.pc = s[0].dnpc;
+      if (s[0].dnpc != s[0].snpc) { i ++; break; }
+    }
+    return i;
+  }
+
+  static bool init = false;
+  if (unlikely(!init)) {
+    pmem_add_code_callback(block_invalidate);
+    init = true;
+  }
+  g_block_miss ++;
+  return block_build(b, cpu.pc, (n < BLOCK_MAX_INST ? n : BLOCK_MAX_INST));
+}
+
+void block_statistic() {
+  Log("block cache hit = %'" PRIu64 ", miss = %'" PRIu64, g_block_hit, g_block_miss);
+}
@@ -15,3 +15,6 @@
 
 INC_PATH += $(NEMU_HOME)/src/engine/$(ENGINE)
 DIRS-y += src/engine/$(ENGINE)
+# the block and JIT engines share the monitor entry and host calls with the interpreter
+DIRS-$(CONFIG_ENGINE_BLOCK) += src/engine/interpreter
+DIRS-$(CONFIG_ENGINE_JIT) += src/engine/interpreter
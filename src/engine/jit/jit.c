@@ -0,0 +1,254 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <sys/mman.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
+#include "jit.h"
+#include "x86-64.h"
+
+#define JIT_CACHE_SIZE CONFIG_JIT_CACHE_SIZE
+#define NR_JIT_BLOCK 4096
+// larger than the host code of any translated block
+#define JIT_MAX_BLOCK_SIZE 8192
+// the monitor regains control after at most this number of instructions
+#define JIT_MAX_BUDGET 65536
+
+static JitBlock jit_block[NR_JIT_BLOCK] = {};
+static uint8_t *jit_cache = NULL;
+static uint8_t *jit_cache_start = NULL; // the first byte after the prologue and epilogue
+uint8_t *jit_cur = NULL;
+uint8_t *jit_epilogue = NULL;
+static int64_t jit_budget = 0; // written by the epilogue
+
+/* jit_enter(&cpu, budget, guest_to_host(CONFIG_MBASE), entry)
+ * runs translated code from `entry', and returns what the block leaves in rax.
+ */
+static uint8_t *(*jit_enter)(CPU_state *, int64_t, uint8_t *, uint8_t *) = NULL;
+
+// the chaining slot of the last block, if it fell through to cpu.pc
+static uint8_t *jit_last_slot = NULL;
+// set when the guest writes to a page with translated code
+static bool jit_stale = false;
+
+static uint64_t g_jit_translate = 0;
+static uint64_t g_jit_flush = 0;
+static uint64_t g_jit_chain = 0;
+IFDEF(CONFIG_JIT_SELF_CHECK, static uint64_t g_jit_checked = 0);
+
+// called by pmem_code_written()
+static void jit_invalidate(paddr_t page) {
+  // Translated code may be running, and blocks are chained to each other,
+  // so all of them are dropped by jit_exec() after the running block leaves.
+  jit_stale = true;
+}
+
+static void jit_init() {
+  jit_cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  Assert(jit_cache != MAP_FAILED, "can not allocate the code cache for JIT");
+  jit_cur = jit_cache;
+
+  // push rbx; push r12; push r14 (rsp is 16-byte aligned after them)
+  jit_enter = (void *)jit_cur;
+  emit_push(RBX);
+  emit8(0x41); emit_push(4);
+  emit8(0x41); emit_push(6);
+  // mov rbx, rdi; mov r12, rsi; mov r14, rdx; jmp rcx
+  emit8(0x48); emit8(0x89); emit8(0xfb);
+  emit8(0x49); emit8(0x89); emit8(0xf4);
+  emit8(0x49); emit8(0x89); emit8(0xd6);
+  emit8(0xff); emit8(0xe1);
+
+  // mov rcx, &jit_budget; mov [rcx], r12; pop r14; pop r12; pop rbx; ret
+  jit_epilogue = jit_cur;
+  emit8(0x48); emit8(0xb9); emit64((uintptr_t)&jit_budget);
+  emit8(0x4c); emit8(0x89); emit8(0x21);
+  emit8(0x41); emit_pop(6);
+  emit8(0x41); emit_pop(4);
+  emit_pop(RBX);
+  emit8(0xc3);
+
+  jit_cache_start = jit_cur;
+  pmem_add_code_callback(jit_invalidate);
+}
+
+// Drop all translated blocks. Blocks which are chained to an entry
+// replaced in jit_block[] are still valid, so this is only done when
+// the code cache is full, or the guest writes to translated code.
+static void jit_flush() {
+  memset(jit_block, 0, sizeof(jit_block));
+  jit_cur = jit_cache_start;
+  jit_last_slot = NULL;
+  jit_stale = false;
+  g_jit_flush ++;
+}
+
+// Return NULL if the block at `pc` is not translated and `translate` is false.
+static JitBlock *jit_get(vaddr_t pc, bool translate) {
+  JitBlock *b = &jit_block[(pc >> 2) & (NR_JIT_BLOCK - 1)];
+  if (likely(b->nr_inst != 0 && b->pc == pc)) return b;
+  if (!translate) return NULL;
+
+  if (jit_cache + JIT_CACHE_SIZE - jit_cur < JIT_MAX_BLOCK_SIZE) jit_flush();
+  b->pc = pc;
+  jit_translate(b);
+  g_jit_translate ++;
+  return b;
+}
+
+/* Execute the instruction at `pc' with the interpreter. Return true if
+ * the instruction transfers control, stops NEMU, enables the MMU, or
+ * writes to translated code.
+ */
+bool jit_interp(vaddr_t pc) {
+  Decode s;
+  s.pc = pc;
+  s.snpc = pc;
+  isa_exec_once(&s);
+  cpu.pc = s.dnpc;
+  return s.dnpc != s.snpc || nemu_state.state != NEMU_RUNNING ||
+    isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH) != MMU_DIRECT || jit_stale;
+}
+
+// A translated store has written to a page with translated code.
+void jit_code_write(uint32_t pmem_page) {
+  IFDEF(CONFIG_PMEM_CODE_PAGES, pmem_code_written(CONFIG_MBASE + ((paddr_t)pmem_page << PMEM_PAGE_SHIFT)));
+}
+
+#ifdef CONFIG_JIT_SELF_CHECK
+static struct {
+  paddr_t addr;
+  int len;
+  word_t old, new;
+} jit_store_log[JIT_BLOCK_MAX_INST];
+static int jit_nr_store = 0;
+static bool jit_touch_mmio = false;
+
+void jit_log_store(paddr_t addr, int len) {
+  Assert(jit_nr_store < ARRLEN(jit_store_log), "too many stores in a block");
+  jit_store_log[jit_nr_store].addr = addr;
+  jit_store_log[jit_nr_store].len = len;
+  jit_store_log[jit_nr_store].old = host_read(guest_to_host(addr), len);
+  jit_nr_store ++;
+}
+
+word_t jit_mmio_read(paddr_t addr, int len) {
+  jit_touch_mmio = true;
+  return paddr_read(addr, len);
+}
+
+void jit_mmio_write(paddr_t addr, int len, word_t data) {
+  jit_touch_mmio = true;
+  paddr_write(addr, len, data);
+}
+
+/* Roll back the stores of block `b', run the `n' instructions executed by
+ * its translated code again with the interpreter from `state', and compare
+ * the results with those of the translated code.
+ */
+static void jit_check(JitBlock *b, int n, CPU_state *state, NEMUState *ns) {
+  CPU_state jit_state = cpu;
+  NEMUState jit_ns = nemu_state;
+  int i;
+  for (i = 0; i < jit_nr_store; i ++) {
+    jit_store_log[i].new = host_read(guest_to_host(jit_store_log[i].addr), jit_store_log[i].len);
+  }
+  for (i = jit_nr_store - 1; i >= 0; i --) {
+    host_write(guest_to_host(jit_store_log[i].addr), jit_store_log[i].len, jit_store_log[i].old);
+  }
+
+  cpu = *state;
+  nemu_state = *ns;
+  for (i = 0; i < n; i ++) jit_interp(cpu.pc);
+  g_jit_checked ++;
+
+  bool ok = (cpu.pc == jit_state.pc && nemu_state.state == jit_ns.state);
+  for (i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    if (cpu.gpr[i] != jit_state.gpr[i]) {
+      Log("JIT self-check: gpr[%d] = " FMT_WORD ", expected " FMT_WORD, i, jit_state.gpr[i], cpu.gpr[i]);
+      ok = false;
+    }
+  }
+  for (i = 0; i < jit_nr_store; i ++) {
+    word_t data = host_read(guest_to_host(jit_store_log[i].addr), jit_store_log[i].len);
+    if (data != jit_store_log[i].new) {
+      Log("JIT self-check: store to " FMT_PADDR " = " FMT_WORD ", expected " FMT_WORD,
+          jit_store_log[i].addr, jit_store_log[i].new, data);
+      ok = false;
+    }
+  }
+  if (!ok) {
+    Log("JIT self-check: block at pc = " FMT_WORD " ends at pc = " FMT_WORD ", expected " FMT_WORD,
+        b->pc, jit_state.pc, cpu.pc);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = b->pc;
+    cpu_request_stop();
+    isa_reg_display();
+  }
+}
+#endif
+
+/* Execute at most `n` instructions starting from cpu.pc. Translated blocks
+ * chained together run without returning here, until the budget is not
+ * enough for the next block, or an instruction executed by the interpreter
+ * transfers control or stops NEMU. Return the number of executed instructions.
+ */
+uint64_t jit_exec(uint64_t n) {
+  if (unlikely(jit_cache == NULL)) jit_init();
+  if (unlikely(jit_stale)) jit_flush();
+
+  JitBlock *b = NULL;
+  // Translated code accesses guest memory without the MMU or mtrace, so
+  // the interpreter is used when address translation or mtrace is enabled.
+  // If cpu.pc is out of CONFIG_MBASE + CONFIG_MSIZE, let the interpreter
+  // execute it or report the error.
+  // Do not translate a block for a short request (e.g. by `si' or when
+  // watchpoints are set), since it may start in the middle of a block.
+  if (isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH) == MMU_DIRECT && MUXDEF(CONFIG_MTRACE, mtrace_span == 0, true) &&
+      jit_in_mem(cpu.pc)) b = jit_get(cpu.pc, n >= JIT_BLOCK_MAX_INST);
+  // Fewer instructions are requested than the block has, execute them one by one.
+  if (b == NULL || b->nr_inst > n) {
+    jit_last_slot = NULL;
+    jit_interp(cpu.pc);
+    return 1;
+  }
+
+#ifdef CONFIG_JIT_SELF_CHECK
+  CPU_state state = cpu;
+  NEMUState ns = nemu_state;
+  jit_nr_store = 0;
+  jit_touch_mmio = false;
+  int64_t budget = b->nr_inst;
+  jit_enter(&cpu, budget, guest_to_host(CONFIG_MBASE), b->code);
+  if (b->native && !jit_touch_mmio) jit_check(b, budget - jit_budget, &state, &ns);
+#else
+  if (jit_last_slot != NULL) {
+    patch_rel32(jit_last_slot + 1, b->code);
+    g_jit_chain ++;
+  }
+  int64_t budget = (n < JIT_MAX_BUDGET ? n : JIT_MAX_BUDGET);
+  jit_last_slot = jit_enter(&cpu, budget, guest_to_host(CONFIG_MBASE), b->code);
+#endif
+  return budget - jit_budget;
+}
+
+void jit_statistic() {
+  Log("JIT translated blocks = %'" PRIu64 ", chained = %'" PRIu64 ", code cache flushes = %'" PRIu64,
+      g_jit_translate, g_jit_chain, g_jit_flush);
+  IFDEF(CONFIG_JIT_SELF_CHECK, Log("JIT self-checked blocks = %'" PRIu64, g_jit_checked));
+}
@@ -0,0 +1,56 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <isa.h>
+
+#define JIT_BLOCK_MAX_INST 32
+
+typedef struct {
+  vaddr_t pc;
+  int nr_inst;  // 0 if the entry is not valid
+  bool native;  // true if no instruction is executed by the interpreter
+  uint8_t *code;
+} JitBlock;
+
+/* Only code in [CONFIG_MBASE, CONFIG_MBASE + CONFIG_MSIZE) is translated.
+ * Translated stores only leave the block at once after writing to
+ * translated code in this range (see emit_store()). Stores to other
+ * regions (e.g. passive device maps) go through paddr_write() instead, so
+ * code there is executed by the interpreter.
+ */
+static inline bool jit_in_mem(vaddr_t pc) {
+  return pc - CONFIG_MBASE <= CONFIG_MSIZE - 4;
+}
+
+/* Translate the guest instructions from b->pc to jit_cur. The translated
+ * block leaves with the address of its chaining slot in rax if it falls
+ * through to the next block, or with NULL otherwise.
+ */
+void jit_translate(JitBlock *b);
+
+// --- called by translated code ---
+extern uint8_t *jit_epilogue;
+bool jit_interp(vaddr_t pc);
+void jit_code_write(uint32_t pmem_page);
+#ifdef CONFIG_JIT_SELF_CHECK
+void jit_log_store(paddr_t addr, int len);
+word_t jit_mmio_read(paddr_t addr, int len);
+void jit_mmio_write(paddr_t addr, int len, word_t data);
+#endif
+
+#endif
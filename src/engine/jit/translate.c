@@ -0,0 +1,198 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <stddef.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include "jit.h"
+#include "x86-64.h"
+
+#define GPR(i) (offsetof(CPU_state, gpr) + (i) * sizeof(word_t))
+#define PC     offsetof(CPU_state, pc)
+
+/* Compute the guest address R(rs1) + imm to eax, and its offset in pmem to
+ * rcx. Return the displacement of the jump to the slow path, which is taken
+ * if the access is not entirely inside pmem. Guest addresses are used as
+ * physical addresses directly, since translated code only runs when the
+ * MMU is off (see jit_exec()).
+ */
+static uint8_t *emit_mem_addr(int rs1, word_t imm, int len) {
+  emit_load_cpu(RAX, GPR(rs1));
+  emit_add_eax_imm(imm);
+  emit_lea_ecx_eax(-CONFIG_MBASE);
+  emit_cmp_ecx_imm(CONFIG_MSIZE - len);
+  return emit_jcc(CC_A);
+}
+
+static void emit_load(int rd, int rs1, word_t imm, int len, bool sext) {
+  uint8_t *slow = emit_mem_addr(rs1, imm, len);
+  emit_load_host(len, sext);
+  uint8_t *done = emit_jmp();
+
+  patch_rel32(slow, jit_cur);
+  emit_mov(RDI, RAX);
+  emit_mov_imm(RSI, len);
+  emit_call(MUXDEF(CONFIG_JIT_SELF_CHECK, jit_mmio_read, paddr_read));
+  if (sext) emit_sext_eax(len);
+
+  patch_rel32(done, jit_cur);
+  if (rd != 0) emit_store_cpu(GPR(rd), RAX);
+}
+
+// the jump to leave the block after a store to translated code, which
+// is taken out of emit_store() by jit_translate()
+static uint8_t *code_write = NULL;
+
+static void emit_store(int rs1, int rs2, word_t imm, int len) {
+  emit_load_cpu(RDX, GPR(rs2));
+  uint8_t *slow = emit_mem_addr(rs1, imm, len);
+#ifdef CONFIG_JIT_SELF_CHECK
+  emit_push(RCX);
+  emit_push(RDX);
+  emit_mov(RDI, RAX);
+  emit_mov_imm(RSI, len);
+  emit_call(jit_log_store);
+  emit_pop(RDX);
+  emit_pop(RCX);
+#endif
+  emit_store_host(len);
+#if defined(CONFIG_PMEM_DIRTY) || defined(CONFIG_PMEM_CODE_PAGES)
+  // rcx is the page number in pmem after this, and is kept for jit_code_write()
+  emit_shr_ecx(PMEM_PAGE_SHIFT);
+#endif
+  IFDEF(CONFIG_PMEM_DIRTY, emit_mark_page(&pmem_dirty[CONFIG_MBASE >> PMEM_PAGE_SHIFT]));
+#ifdef CONFIG_PMEM_CODE_PAGES
+  emit_test_page(&pmem_code[CONFIG_MBASE >> PMEM_PAGE_SHIFT]);
+  code_write = emit_jcc(CC_NE);
+#endif
+  uint8_t *done = emit_jmp();
+
+  patch_rel32(slow, jit_cur);
+  emit_mov(RDI, RAX);
+  emit_mov_imm(RSI, len);
+  emit_call(MUXDEF(CONFIG_JIT_SELF_CHECK, jit_mmio_write, paddr_write));
+
+  patch_rel32(done, jit_cur);
+}
+
+/* Translation templates for the patterns in src/isa/riscv32/inst.c.
+ * Return false if there is no template for the instruction, and it will
+ * be executed by the interpreter.
+ */
+static bool translate_inst(vaddr_t pc, uint32_t i) {
+  int rd  = BITS(i, 11, 7);
+  int rs1 = BITS(i, 19, 15);
+  int rs2 = BITS(i, 24, 20);
+  word_t immI = SEXT(BITS(i, 31, 20), 12);
+  word_t immU = SEXT(BITS(i, 31, 12), 20) << 12;
+  word_t immS = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7);
+
+  switch (BITS(i, 6, 0)) {
+    case 0x17: // auipc
+      if (rd != 0) emit_store_cpu_imm(GPR(rd), pc + immU);
+      return true;
+    case 0x03:
+      switch (BITS(i, 14, 12)) {
+        case 4: emit_load(rd, rs1, immI, 1, false); return true; // lbu
+      }
+      break;
+    case 0x23:
+      switch (BITS(i, 14, 12)) {
+        case 0: emit_store(rs1, rs2, immS, 1); return true; // sb
+      }
+      break;
+  }
+  return false;
+}
+
+void jit_translate(JitBlock *b) {
+  struct { uint8_t *rel; int nr_inst; bool code_write; } exit[JIT_BLOCK_MAX_INST];
+  int nr_exit = 0;
+  vaddr_t pc = b->pc;
+  int i;
+
+  // Leave before running the block if the budget is not enough. The number
+  // of instructions is filled after the block is translated.
+  b->code = jit_cur;
+  emit_sub_r12_imm(0);
+  uint8_t *nr_inst = jit_cur - 4;
+  uint8_t *bail = emit_jcc(CC_S);
+
+  b->native = true;
+  for (i = 0; i < JIT_BLOCK_MAX_INST && jit_in_mem(pc); i ++, pc += 4) {
+    pmem_mark_code(pc);
+    uint32_t inst = vaddr_ifetch(pc, 4);
+    if (translate_inst(pc, inst)) {
+      if (code_write != NULL) {
+        exit[nr_exit].rel = code_write;
+        exit[nr_exit].nr_inst = i + 1;
+        exit[nr_exit].code_write = true;
+        nr_exit ++;
+        code_write = NULL;
+      }
+      continue;
+    }
+
+#ifdef CONFIG_JIT_SELF_CHECK
+    // Such an instruction forms a block by itself, so that
+    // the other blocks are entirely translated and can be checked.
+    if (i > 0) break;
+#endif
+    b->native = false;
+    emit_mov_imm(RDI, pc);
+    emit_call(jit_interp);
+    emit_test_eax();
+    exit[nr_exit].rel = emit_jcc(CC_NE);
+    exit[nr_exit].nr_inst = i + 1;
+    exit[nr_exit].code_write = false;
+    nr_exit ++;
+#ifdef CONFIG_JIT_SELF_CHECK
+    i ++; pc += 4;
+    break;
+#endif
+  }
+  Assert(i > 0, "no instruction to translate at pc = " FMT_WORD, b->pc);
+  b->nr_inst = i;
+  memcpy(nr_inst, &i, 4);
+
+  // Fall through to the next block. The jump at the chaining slot is
+  // patched to the next block once it is translated.
+  uint8_t *slot = jit_cur;
+  emit_jmp();
+  emit_store_cpu_imm(PC, pc);
+  emit_lea_rax(slot);
+  patch_rel32(emit_jmp(), jit_epilogue);
+
+  patch_rel32(bail, jit_cur);
+  emit_add_r12_imm(i);
+  emit_store_cpu_imm(PC, b->pc);
+  emit_zero_eax();
+  patch_rel32(emit_jmp(), jit_epilogue);
+
+  // The interpreter has updated cpu.pc, return the unused budget. After
+  // a store to translated code, leave with the next pc, since the rest of
+  // the block may be changed.
+  for (int k = 0; k < nr_exit; k ++) {
+    patch_rel32(exit[k].rel, jit_cur);
+    if (exit[k].code_write) {
+      emit_mov(RDI, RCX);
+      emit_call(jit_code_write);
+      emit_store_cpu_imm(PC, b->pc + exit[k].nr_inst * 4);
+    }
+    emit_add_r12_imm(i - exit[k].nr_inst);
+    emit_zero_eax();
+    patch_rel32(emit_jmp(), jit_epilogue);
+  }
+}
@@ -0,0 +1,142 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __JIT_X86_64_H__
+#define __JIT_X86_64_H__
+
+#include <common.h>
+
+/* Host register usage of translated code:
+ *   rbx: &cpu
+ *   r12: number of guest instructions allowed to run before leaving
+ *   r14: guest_to_host(CONFIG_MBASE)
+ *   rax, rcx, rdx, rsi, rdi: scratch, and arguments of host calls
+ */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+enum { CC_NE = 0x5, CC_A = 0x7, CC_S = 0x8 };
+
+// where the next host instruction is emitted
+extern uint8_t *jit_cur;
+
+static inline void emit8(uint8_t x) { *jit_cur ++ = x; }
+static inline void emit32(uint32_t x) { memcpy(jit_cur, &x, 4); jit_cur += 4; }
+static inline void emit64(uint64_t x) { memcpy(jit_cur, &x, 8); jit_cur += 8; }
+
+// mov r32, [rbx + disp32]
+static inline void emit_load_cpu(int r, uint32_t disp) {
+  emit8(0x8b); emit8(0x80 | (r << 3) | RBX); emit32(disp);
+}
+
+// mov [rbx + disp32], r32
+static inline void emit_store_cpu(uint32_t disp, int r) {
+  emit8(0x89); emit8(0x80 | (r << 3) | RBX); emit32(disp);
+}
+
+// mov dword [rbx + disp32], imm32
+static inline void emit_store_cpu_imm(uint32_t disp, uint32_t imm) {
+  emit8(0xc7); emit8(0x80 | RBX); emit32(disp); emit32(imm);
+}
+
+// mov r32, imm32
+static inline void emit_mov_imm(int r, uint32_t imm) { emit8(0xb8 + r); emit32(imm); }
+// mov dst32, src32
+static inline void emit_mov(int dst, int src) { emit8(0x89); emit8(0xc0 | (src << 3) | dst); }
+// add eax, imm32
+static inline void emit_add_eax_imm(uint32_t imm) { emit8(0x05); emit32(imm); }
+// lea ecx, [rax + disp32]
+static inline void emit_lea_ecx_eax(uint32_t disp) { emit8(0x8d); emit8(0x88); emit32(disp); }
+// cmp ecx, imm32
+static inline void emit_cmp_ecx_imm(uint32_t imm) { emit8(0x81); emit8(0xf9); emit32(imm); }
+// test eax, eax
+static inline void emit_test_eax() { emit8(0x85); emit8(0xc0); }
+// xor eax, eax
+static inline void emit_zero_eax() { emit8(0x31); emit8(0xc0); }
+// sub r12, imm32
+static inline void emit_sub_r12_imm(uint32_t imm) { emit8(0x49); emit8(0x81); emit8(0xec); emit32(imm); }
+// add r12, imm32
+static inline void emit_add_r12_imm(uint32_t imm) { emit8(0x49); emit8(0x81); emit8(0xc4); emit32(imm); }
+static inline void emit_push(int r) { emit8(0x50 + r); }
+static inline void emit_pop(int r) { emit8(0x58 + r); }
+
+// mov rax, imm64; call rax
+static inline void emit_call(const void *f) {
+  emit8(0x48); emit8(0xb8); emit64((uintptr_t)f);
+  emit8(0xff); emit8(0xd0);
+}
+
+// lea rax, [rip + disp32]
+static inline void emit_lea_rax(const void *target) {
+  emit8(0x48); emit8(0x8d); emit8(0x05);
+  emit32((uint8_t *)target - (jit_cur + 4));
+}
+
+/* Jumps are emitted with 32-bit displacements. The following two return
+ * the address of the displacement, which is filled by patch_rel32().
+ */
+static inline uint8_t *emit_jmp() { emit8(0xe9); emit32(0); return jit_cur - 4; }
+static inline uint8_t *emit_jcc(int cc) { emit8(0x0f); emit8(0x80 | cc); emit32(0); return jit_cur - 4; }
+
+static inline void patch_rel32(uint8_t *rel, const void *target) {
+  int32_t disp = (uint8_t *)target - (rel + 4);
+  memcpy(rel, &disp, 4);
+}
+
+// load `len` bytes at [r14 + rcx] to eax, with zero or sign extension
+static inline void emit_load_host(int len, bool sext) {
+  emit8(0x41);
+  switch (len) {
+    case 1: emit8(0x0f); emit8(sext ? 0xbe : 0xb6); break;
+    case 2: emit8(0x0f); emit8(sext ? 0xbf : 0xb7); break;
+    case 4: emit8(0x8b); break;
+    default: panic("unsupported len = %d", len);
+  }
+  emit8(0x04); emit8(0x0e);
+}
+
+// movsx eax, al/ax
+static inline void emit_sext_eax(int len) {
+  switch (len) {
+    case 1: emit8(0x0f); emit8(0xbe); emit8(0xc0); break;
+    case 2: emit8(0x0f); emit8(0xbf); emit8(0xc0); break;
+  }
+}
+
+// store the lowest `len` bytes of edx to [r14 + rcx]
+static inline void emit_store_host(int len) {
+  switch (len) {
+    case 1: emit8(0x41); emit8(0x88); break;
+    case 2: emit8(0x66); emit8(0x41); emit8(0x89); break;
+    case 4: emit8(0x41); emit8(0x89); break;
+    default: panic("unsupported len = %d", len);
+  }
+  emit8(0x14); emit8(0x0e);
+}
+
+// shr ecx, imm8
+static inline void emit_shr_ecx(int shift) { emit8(0xc1); emit8(0xe9); emit8(shift); }
+
+// mov rax, map; mov byte [rax + rcx], 1
+static inline void emit_mark_page(const uint8_t *map) {
+  emit8(0x48); emit8(0xb8); emit64((uintptr_t)map);
+  emit8(0xc6); emit8(0x04); emit8(0x08); emit8(0x01);
+}
+
+// mov rax, map; cmp byte [rax + rcx], 0
+static inline void emit_test_page(const uint8_t *map) {
+  emit8(0x48); emit8(0xb8); emit64((uintptr_t)map);
+  emit8(0x80); emit8(0x3c); emit8(0x08); emit8(0x00);
+}
+
+#endif
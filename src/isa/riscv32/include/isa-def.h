@@ -21,13 +21,22 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  word_t satp;
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
 typedef struct {
   uint32_t inst;
+  int rd, rs1, rs2; // rs1/rs2 are 0 if they are not used by the instruction
+  word_t imm;
 } MUXDEF(CONFIG_RV64, riscv64_ISADecodeInfo, riscv32_ISADecodeInfo);
 
+#ifdef CONFIG_RV64
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+#else
+// Sv32 is enabled by satp.MODE
+#define isa_mmu_check(vaddr, len, type) (cpu.satp >> 31 ? MMU_TRANSLATE : MMU_DIRECT)
+#define isa_mmu_asid() BITS(cpu.satp, 30, 22)
+#endif
 
 #endif
@@ -17,62 +17,81 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <memory/tlb.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_R, TYPE_I, TYPE_U, TYPE_S, TYPE_J,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
-#define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
-#define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
-#define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define src1R() do { s->isa.rs1 = rs1; } while (0)
+#define src2R() do { s->isa.rs2 = rs2; } while (0)
+#define immI() do { s->isa.imm = SEXT(BITS(i, 31, 20), 12); } while(0)
+#define immU() do { s->isa.imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
+#define immS() do { s->isa.imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define immJ() do { s->isa.imm = (SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) | \
+  (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1); } while(0)
 
-static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+static void decode_operand(Decode *s, int type) {
   uint32_t i = s->isa.inst;
   int rs1 = BITS(i, 19, 15);
   int rs2 = BITS(i, 24, 20);
-  *rd     = BITS(i, 11, 7);
+  s->isa.rd  = BITS(i, 11, 7);
+  s->isa.rs1 = 0;
+  s->isa.rs2 = 0;
+  s->isa.imm = 0;
   switch (type) {
+    case TYPE_R: src1R(); src2R();         break;
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_J:                   immJ(); break;
     case TYPE_N: break;
     default: panic("unsupported type = %d", type);
   }
 }
 
 static int decode_exec(Decode *s) {
+  IFDEF(CONFIG_ENGINE_BLOCK, Decode *first = s);
   s->dnpc = s->snpc;
 
 #define INSTPAT_INST(s) ((s)->isa.inst)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  int rd = 0; \
-  word_t src1 = 0, src2 = 0, imm = 0; \
-  decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  decode_operand(s, concat(TYPE_, type)); \
+  INSTPAT_BODY(s, name); \
+  __attribute__((unused)) int rd = s->isa.rd; \
+  __attribute__((unused)) word_t src1 = R(s->isa.rs1), src2 = R(s->isa.rs2), imm = s->isa.imm; \
   __VA_ARGS__ ; \
+  R(0) = 0; /* reset $zero to 0 */ \
 }
 
   INSTPAT_START();
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(rd) = s->snpc; s->dnpc = s->pc + imm);
 
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  // only satp (0x180) is implemented, accesses to other CSRs are invalid
+  INSTPAT("0001100 00000 ????? 001 ????? 11100 11", csrrw_satp, I, word_t t = cpu.satp; cpu.satp = src1; R(rd) = t);
+  INSTPAT("0001100 00000 ????? 010 ????? 11100 11", csrrs_satp, I, word_t t = cpu.satp; if (s->isa.rs1 != 0) cpu.satp = t | src1; R(rd) = t);
+  INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence_vma, R, tlb_flush(src1, s->isa.rs1 == 0, src2, s->isa.rs2 == 0));
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
-  R(0) = 0; // reset $zero to 0
-
-  return 0;
+  // the number of executed instructions
+  return MUXDEF(CONFIG_ENGINE_BLOCK, s - first + 1, 1);
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DECODE_HANDLER
+  // the instruction has been fetched and decoded before
+  if (s->handler != NULL) return decode_exec(s);
+#endif
   s->isa.inst = inst_fetch(&s->snpc, 4);
   return decode_exec(s);
 }
@@ -16,7 +16,48 @@
 #include <isa.h>
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
+#include <memory/tlb.h>
 
+enum {
+  PTE_V = 0x01, PTE_R = 0x02, PTE_W = 0x04, PTE_X = 0x08,
+  PTE_U = 0x10, PTE_G = 0x20, PTE_A = 0x40, PTE_D = 0x80,
+};
+
+#define MEGAPAGE_SIZE (1ul << 22)
+
+/* Sv32 page table walk. The translation is also filled into the TLB.
+ * Privilege levels are not modeled yet, so the U bit is not checked.
+ */
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
-  return MEM_RET_FAIL;
+  paddr_t base = (paddr_t)BITS(cpu.satp, 21, 0) << PAGE_SHIFT;
+  paddr_t pte_addr;
+  word_t pte;
+  bool global = false;
+  int level;
+  for (level = 1; ; level --) {
+    if (level < 0) return MEM_RET_FAIL;
+    pte_addr = base + BITS(vaddr, 21 + level * 10, 12 + level * 10) * 4;
+    pte = paddr_read(pte_addr, 4);
+    tlb_nr_pte_read ++;
+    if (!(pte & PTE_V) || ((pte & PTE_W) && !(pte & PTE_R))) return MEM_RET_FAIL;
+    global |= (pte & PTE_G) != 0;
+    if (pte & (PTE_R | PTE_X)) break; // leaf
+    base = (paddr_t)BITS(pte, 31, 10) << PAGE_SHIFT;
+  }
+
+  int perm = (type == MEM_TYPE_IFETCH ? PTE_X : type == MEM_TYPE_READ ? PTE_R : PTE_W);
+  if (!(pte & perm)) return MEM_RET_FAIL;
+  // misaligned megapage
+  if (level == 1 && BITS(pte, 19, 10) != 0) return MEM_RET_FAIL;
+
+  word_t new_pte = pte | PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+  if (new_pte != pte) paddr_write(pte_addr, 4, new_pte);
+
+  paddr_t ppage = (level == 1 ?
+      ((paddr_t)BITS(pte, 31, 20) << 22) | (vaddr & (MEGAPAGE_SIZE - PAGE_SIZE)) :
+      (paddr_t)BITS(pte, 31, 10) << PAGE_SHIFT);
+  // writes go through the walk until the dirty bit is set
+  tlb_fill(type, vaddr, ppage, (level == 1 ? MEGAPAGE_SIZE : PAGE_SIZE), isa_mmu_asid(), global,
+      (new_pte & PTE_W) && (new_pte & PTE_D));
+  return ppage | MEM_RET_OK;
 }
@@ -15,25 +15,62 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/tlb.h>
 #include <device/mmio.h>
 #include <isa.h>
 
-#if   defined(CONFIG_PMEM_MALLOC)
+#if defined(CONFIG_PMEM_MMAP) || defined(CONFIG_PMEM_EXTRA)
+#define PMEM_USE_MMAP
+#include <sys/mman.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
 static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
 
-uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
-paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
+#define NR_PMEM_REGION 16
+
+typedef struct {
+  paddr_t base;
+  uint64_t size;
+  uint8_t *host;
+  bool mmapped;
+  bool lazy_fill; // filled by pmem_fault_handler() on the first access
+} PMemRegion;
+
+static PMemRegion region[NR_PMEM_REGION] = {};
+static int nr_region = 0;
+
+uint8_t **pmem_dir[1ull << (PADDR_BITS - PMEM_DIR_SHIFT)] = {};
+IFDEF(CONFIG_PMEM_DIRTY, uint8_t pmem_dirty[1ull << (PADDR_BITS - PMEM_PAGE_SHIFT)] = {});
+IFDEF(CONFIG_PMEM_CODE_PAGES, uint8_t pmem_code[1ull << (PADDR_BITS - PMEM_PAGE_SHIFT)] = {});
+
+#define NR_CODE_CALLBACK 4
+static void (*code_callback[NR_CODE_CALLBACK])(paddr_t page) = {};
+static int nr_code_callback = 0;
 
-static word_t pmem_read(paddr_t addr, int len) {
-  word_t ret = host_read(guest_to_host(addr), len);
-  return ret;
+static PMemRegion *find_region(paddr_t addr) {
+  for (int i = 0; i < nr_region; i ++) {
+    if (addr - region[i].base < region[i].size) return &region[i];
+  }
+  return NULL;
 }
 
-static void pmem_write(paddr_t addr, int len, word_t data) {
-  host_write(guest_to_host(addr), len, data);
+uint8_t* guest_to_host(paddr_t paddr) {
+  uint8_t *host = pmem_host(paddr);
+  Assert(host != NULL, "address = " FMT_PADDR " is not in pmem", paddr);
+  return host;
+}
+
+paddr_t host_to_guest(uint8_t *haddr) {
+  for (int i = 0; i < nr_region; i ++) {
+    if ((uint64_t)(haddr - region[i].host) < region[i].size) return region[i].base + (haddr - region[i].host);
+  }
+  panic("host address %p is not in pmem", haddr);
 }
 
 static void out_of_bound(paddr_t addr) {
@@ -41,24 +78,267 @@ static void out_of_bound(paddr_t addr) {
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
 
+#ifdef PMEM_USE_MMAP
+// also the size of a transparent huge page on x86-64 and aarch64
+#define PMEM_CHUNK_SIZE (2ul << 20)
+
+#ifdef CONFIG_MEM_RANDOM
+/* Regions with lazy_fill are mapped without access at first. The first
+ * access to a chunk raises SIGSEGV, and the handler makes the chunk
+ * accessible and fills it.
+ */
+static uint8_t pmem_random_byte = 0;
+
+static void pmem_fault_handler(int sig, siginfo_t *info, void *ucontext) {
+  uint8_t *addr = info->si_addr;
+  for (int i = 0; i < nr_region; i ++) {
+    PMemRegion *r = &region[i];
+    if (!r->lazy_fill || addr < r->host || addr >= r->host + r->size) continue;
+    uint8_t *chunk = (uint8_t *)ROUNDDOWN(addr, PMEM_CHUNK_SIZE);
+    size_t size = r->host + r->size - chunk;
+    if (size > PMEM_CHUNK_SIZE) size = PMEM_CHUNK_SIZE;
+    if (mprotect(chunk, size, PROT_READ | PROT_WRITE) == 0) {
+      memset(chunk, pmem_random_byte, size);
+      return;
+    }
+    break;
+  }
+  // not caused by pmem, let the fault happen again with the default action
+  signal(SIGSEGV, SIG_DFL);
+}
+
+static void init_pmem_fault_handler() {
+  pmem_random_byte = rand();
+  struct sigaction s;
+  memset(&s, 0, sizeof(s));
+  s.sa_sigaction = pmem_fault_handler;
+  s.sa_flags = SA_SIGINFO;
+  int ret = sigaction(SIGSEGV, &s, NULL);
+  Assert(ret == 0, "Can not set signal handler");
+}
+#endif
+
+// Host pages are not allocated until they are accessed.
+static uint8_t *pmem_mmap(uint64_t size) {
+  // reserve one more chunk to align the memory for huge pages
+  uint8_t *p = mmap(NULL, size + PMEM_CHUNK_SIZE, MUXDEF(CONFIG_MEM_RANDOM, PROT_NONE, PROT_READ | PROT_WRITE),
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(p != MAP_FAILED, "Can not map the physical memory");
+  p = (uint8_t *)ROUNDUP(p, PMEM_CHUNK_SIZE);
+#ifdef MADV_HUGEPAGE
+  madvise(p, size, MADV_HUGEPAGE);
+#endif
+  return p;
+}
+#endif
+
+static void add_region(paddr_t base, uint64_t size, uint8_t *host, bool mmapped) {
+  Assert(nr_region < NR_PMEM_REGION, "too many memory regions");
+  Assert(((base | size) & BITMASK(PMEM_PAGE_SHIFT)) == 0,
+      "memory region [" FMT_PADDR ", +%#" PRIx64 ") is not page aligned", base, size);
+  Assert(size != 0 && base + size - 1 >= base && ((uint64_t)base + size - 1) >> PADDR_BITS == 0,
+      "memory region [" FMT_PADDR ", +%#" PRIx64 ") is out of the physical address space", base, size);
+  for (int i = 0; i < nr_region; i ++) {
+    Assert(base + size - 1 < region[i].base || base > region[i].base + region[i].size - 1,
+        "memory region [" FMT_PADDR ", +%#" PRIx64 ") is overlapped with another one", base, size);
+  }
+
+  region[nr_region ++] = (PMemRegion){ .base = base, .size = size, .host = host,
+    .mmapped = mmapped, .lazy_fill = mmapped && ISDEF(CONFIG_MEM_RANDOM) };
+
+  // only the page tables of the directory entries covering the region are allocated
+  for (uint64_t off = 0; off < size; off += 1ull << PMEM_PAGE_SHIFT) {
+    paddr_t addr = base + off;
+    uint8_t ***pt = &pmem_dir[addr >> PMEM_DIR_SHIFT];
+    if (*pt == NULL) {
+      *pt = calloc(PMEM_DIR_SIZE >> PMEM_PAGE_SHIFT, sizeof(uint8_t *));
+      assert(*pt);
+    }
+    (*pt)[BITS(addr, PMEM_DIR_SHIFT - 1, PMEM_PAGE_SHIFT)] = host + off;
+  }
+  Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", base, (paddr_t)(base + size - 1));
+}
+
+#ifdef CONFIG_PMEM_EXTRA
+// parse "BASE:SIZE[,BASE:SIZE]..."
+static void add_extra_regions(const char *str) {
+  while (*str != '\0') {
+    char *end;
+    uint64_t base = strtoull(str, &end, 0);
+    Assert(*end == ':', "bad memory region list '%s'", CONFIG_PMEM_EXTRA_REGIONS);
+    uint64_t size = strtoull(end + 1, &end, 0);
+    Assert(*end == ',' || *end == '\0', "bad memory region list '%s'", CONFIG_PMEM_EXTRA_REGIONS);
+    add_region(base, size, pmem_mmap(size), true);
+    str = (*end == ',' ? end + 1 : end);
+  }
+}
+#endif
+
+void pmem_dirty_scan_range(paddr_t addr, uint64_t len,
+    void (*callback)(paddr_t addr, uint64_t len), bool clear) {
+#ifdef CONFIG_PMEM_DIRTY
+  if (len == 0) return;
+  uint64_t p = addr >> PMEM_PAGE_SHIFT;
+  uint64_t end = (((uint64_t)addr + len - 1) >> PMEM_PAGE_SHIFT) + 1;
+  while (p < end) {
+    if (!pmem_dirty[p]) { p ++; continue; }
+    uint64_t start = p;
+    while (p < end && pmem_dirty[p]) p ++;
+    if (clear) memset(&pmem_dirty[start], 0, p - start);
+    if (callback != NULL) callback(start << PMEM_PAGE_SHIFT, (p - start) << PMEM_PAGE_SHIFT);
+  }
+#endif
+}
+
+void pmem_dirty_scan(void (*callback)(paddr_t addr, uint64_t len), bool clear) {
+  for (int i = 0; i < nr_region; i ++) {
+    pmem_dirty_scan_range(region[i].base, region[i].size, callback, clear);
+  }
+}
+
+void pmem_add_device_region(paddr_t addr, uint64_t len, uint8_t *host) {
+  add_region(addr, ROUNDUP(len, 1ull << PMEM_PAGE_SHIFT), host, false);
+}
+
+void pmem_add_code_callback(void (*callback)(paddr_t page)) {
+  Assert(nr_code_callback < NR_CODE_CALLBACK, "too many code callbacks");
+  code_callback[nr_code_callback ++] = callback;
+}
+
+#ifdef CONFIG_PMEM_CODE_PAGES
+void pmem_code_written(paddr_t addr) {
+  paddr_t page = addr & ~(paddr_t)((1 << PMEM_PAGE_SHIFT) - 1);
+  // clear the mark first, the callbacks may mark the page again
+  pmem_code[page >> PMEM_PAGE_SHIFT] = 0;
+  for (int i = 0; i < nr_code_callback; i ++) code_callback[i](page);
+}
+#endif
+
+// Make [addr, addr + len) of pmem accessible to system calls such as read(),
+// which fail with EFAULT instead of raising SIGSEGV.
+void pmem_prefault(paddr_t addr, size_t len) {
+#if defined(PMEM_USE_MMAP) && defined(CONFIG_MEM_RANDOM)
+  PMemRegion *r = find_region(addr);
+  if (r == NULL || !r->lazy_fill) return;
+  uint8_t *host = r->host + (addr - r->base);
+  for (uint8_t *p = (uint8_t *)ROUNDDOWN(host, PMEM_CHUNK_SIZE); p < host + len; p += PMEM_CHUNK_SIZE) {
+    (void)*(volatile uint8_t *)p;
+  }
+#endif
+}
+
+/* Map `len' bytes of file `fd' from offset 0 to pmem at `addr' copy-on-write.
+ * The rest of the last host page is filled with zero. Return false if the
+ * file can not be mapped there, and it should be read instead.
+ */
+bool pmem_map_file(paddr_t addr, int fd, size_t len) {
+#ifdef PMEM_USE_MMAP
+  PMemRegion *r = find_region(addr);
+  if (r == NULL || !r->mmapped) return false;
+  uint8_t *host = r->host + (addr - r->base);
+  size_t map_len = ROUNDUP(len, sysconf(_SC_PAGESIZE));
+  if (((uintptr_t)host & (sysconf(_SC_PAGESIZE) - 1)) != 0 ||
+      map_len > r->size - (addr - r->base)) return false;
+  // fill the chunks first, or the fault handler would overwrite the file
+  pmem_prefault(addr, len);
+  return mmap(host, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+#else
+  return false;
+#endif
+}
+
 void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  pmem = pmem_mmap(CONFIG_MSIZE);
+#endif
+  // with PMEM_MMAP, the memory is filled lazily by pmem_fault_handler()
+  IFNDEF(CONFIG_PMEM_MMAP, IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE)));
+  add_region(CONFIG_MBASE, CONFIG_MSIZE, pmem, ISDEF(CONFIG_PMEM_MMAP));
+  IFDEF(CONFIG_PMEM_EXTRA, add_extra_regions(CONFIG_PMEM_EXTRA_REGIONS));
+#if defined(PMEM_USE_MMAP) && defined(CONFIG_MEM_RANDOM)
+  init_pmem_fault_handler();
 #endif
-  IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
-  Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
+  init_tlb();
 }
 
 word_t paddr_read(paddr_t addr, int len) {
-  if (likely(in_pmem(addr))) return pmem_read(addr, len);
+  uint8_t *host = pmem_host(addr);
+  if (likely(host != NULL)) return host_read(host, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  uint8_t *host = pmem_host(addr);
+  if (likely(host != NULL)) {
+    host_write(host, len, data);
+    pmem_set_dirty(addr);
+    pmem_set_dirty(addr + len - 1);
+    pmem_check_code(addr);
+    pmem_check_code(addr + len - 1);
+    return;
+  }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+// the number of bytes from `addr' to the end of its region, at most `len'
+static size_t pmem_run(paddr_t addr, size_t len) {
+  PMemRegion *r = find_region(addr);
+  if (r == NULL) return 0;
+  uint64_t left = r->size - (addr - r->base);
+  return (len < left ? len : left);
+}
+
+// the length of the next access to a device by a bulk copy
+static int io_len(paddr_t addr, size_t len) {
+  return ((addr & 0x3) == 0 && len >= 4 ? 4 : 1);
+}
+
+/* Copy `len' bytes between the physical memory at `addr' and `buf'. Each
+ * run in a memory region is copied with one memcpy(), and the others
+ * (e.g. MMIO) are accessed through paddr_read() and paddr_write().
+ */
+void paddr_read_bulk(paddr_t addr, void *buf, size_t len) {
+  uint8_t *p = buf;
+  while (len > 0) {
+    size_t n = pmem_run(addr, len);
+    if (n > 0) {
+      memcpy(p, pmem_host(addr), n);
+    } else {
+      n = io_len(addr, len);
+      word_t data = paddr_read(addr, n);
+      memcpy(p, &data, n);
+    }
+    addr += n; p += n; len -= n;
+  }
+}
+
+void paddr_write_bulk(paddr_t addr, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  while (len > 0) {
+    size_t n = pmem_run(addr, len);
+    if (n > 0) {
+      memcpy(pmem_host(addr), p, n);
+#ifdef CONFIG_PMEM_DIRTY
+      uint64_t first = addr >> PMEM_PAGE_SHIFT, last = (addr + n - 1) >> PMEM_PAGE_SHIFT;
+      memset(&pmem_dirty[first], 1, last - first + 1);
+#endif
+#ifdef CONFIG_PMEM_CODE_PAGES
+      for (paddr_t page = addr; page - addr < n; page = (page | ((1 << PMEM_PAGE_SHIFT) - 1)) + 1) {
+        pmem_check_code(page);
+      }
+#endif
+    } else {
+      n = io_len(addr, len);
+      word_t data = 0;
+      memcpy(&data, p, n);
+      paddr_write(addr, n, data);
+    }
+    addr += n; p += n; len -= n;
+  }
+}
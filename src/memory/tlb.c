@@ -0,0 +1,75 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/tlb.h>
+
+static_assert((TLB_SIZE & (TLB_SIZE - 1)) == 0, "TLB_SIZE must be a power of 2");
+
+TLBEntry tlb[NR_TLB][TLB_SIZE] = {};
+uint64_t tlb_nr_hit[NR_TLB] = {};
+static uint64_t tlb_nr_miss[NR_TLB] = {};
+uint64_t tlb_nr_pte_read = 0;
+static bool tlb_has_superpage = false;
+
+void tlb_fill(int type, vaddr_t vaddr, paddr_t ppage, vaddr_t size, uint32_t asid, bool global, bool writable) {
+  TLBEntry *e = tlb_entry(type, vaddr);
+  // an entry always translates a single page, even if it is from a superpage
+  e->vpn = vaddr >> PAGE_SHIFT;
+  e->vpn_mask = ~((size >> PAGE_SHIFT) - 1);
+  e->asid = asid;
+  e->asid_mask = (global ? 0 : -1);
+  e->ppage = ppage;
+  e->writable = writable;
+  if (size > PAGE_SIZE) tlb_has_superpage = true;
+}
+
+paddr_t tlb_refill(vaddr_t vaddr, int len, int type) {
+  tlb_nr_miss[type != MEM_TYPE_IFETCH] ++;
+  paddr_t pg_base = isa_mmu_translate(vaddr, len, type);
+  // exceptions are not supported yet
+  Assert((pg_base & PAGE_MASK) == MEM_RET_OK, "page fault at vaddr = " FMT_WORD
+      " (%s) at pc = " FMT_WORD, vaddr,
+      (type == MEM_TYPE_IFETCH ? "ifetch" : type == MEM_TYPE_READ ? "read" : "write"), cpu.pc);
+  return pg_base | (vaddr & PAGE_MASK);
+}
+
+void tlb_flush(vaddr_t vaddr, bool all_vaddr, uint32_t asid, bool all_asid) {
+  vaddr_t vpn = vaddr >> PAGE_SHIFT;
+  // Other pages of a superpage may be cached anywhere, otherwise only
+  // the entry indexed by `vaddr` should be checked.
+  bool scan = all_vaddr || tlb_has_superpage;
+  int i, j;
+  for (i = 0; i < NR_TLB; i ++) {
+    for (j = (scan ? 0 : vpn & (TLB_SIZE - 1)); j < (scan ? TLB_SIZE : (vpn & (TLB_SIZE - 1)) + 1); j ++) {
+      TLBEntry *e = &tlb[i][j];
+      if (e->vpn == TLB_INVALID) continue;
+      if (!all_vaddr && ((e->vpn ^ vpn) & e->vpn_mask) != 0) continue;
+      if (!all_asid && (e->asid_mask == 0 || e->asid != asid)) continue;
+      e->vpn = TLB_INVALID;
+    }
+  }
+  if (all_vaddr && all_asid) tlb_has_superpage = false;
+}
+
+void init_tlb() {
+  tlb_flush(0, true, 0, true);
+}
+
+void tlb_statistic() {
+  if (tlb_nr_miss[TLB_I] + tlb_nr_miss[TLB_D] == 0) return;
+  Log("ITLB hit = %'" PRIu64 ", miss = %'" PRIu64 "; DTLB hit = %'" PRIu64 ", miss = %'" PRIu64
+      "; page table entries read = %'" PRIu64, tlb_nr_hit[TLB_I], tlb_nr_miss[TLB_I],
+      tlb_nr_hit[TLB_D], tlb_nr_miss[TLB_D], tlb_nr_pte_read);
+}
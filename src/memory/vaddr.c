@@ -13,17 +13,112 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <isa.h>
-#include <memory/paddr.h>
+#include <memory/tlb.h>
 
-word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+static inline paddr_t vaddr_translate(vaddr_t addr, int len, int type) {
+  TLBEntry *e = tlb_entry(type, addr);
+  if (likely(tlb_hit(e, addr, type))) {
+    tlb_nr_hit[type != MEM_TYPE_IFETCH] ++;
+    return e->ppage | (addr & PAGE_MASK);
+  }
+  return tlb_refill(addr, len, type);
 }
 
-word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+static inline bool cross_page(vaddr_t addr, int len) {
+  return (addr & PAGE_MASK) + len > PAGE_SIZE;
 }
 
-void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+static word_t vaddr_read_translate(vaddr_t addr, int len, int type) {
+  if (likely(!cross_page(addr, len))) {
+    paddr_t paddr = vaddr_translate(addr, len, type);
+    uint8_t *host = paddr_host(paddr, len);
+    word_t ret = likely(host != NULL) ? host_read(host, len) : paddr_read(paddr, len);
+    if (type == MEM_TYPE_READ) mtrace(paddr, len, ret, false);
+    return ret;
+  }
+  // translate an access crossing a page boundary byte by byte
+  word_t ret = 0;
+  for (int i = 0; i < len; i ++) {
+    paddr_t paddr = vaddr_translate(addr + i, 1, type);
+    word_t byte = paddr_read(paddr, 1);
+    if (type == MEM_TYPE_READ) mtrace(paddr, 1, byte, false);
+    ret |= byte << (i * 8);
+  }
+  return ret;
+}
+
+static void vaddr_write_translate(vaddr_t addr, int len, word_t data) {
+  if (likely(!cross_page(addr, len))) {
+    paddr_t paddr = vaddr_translate(addr, len, MEM_TYPE_WRITE);
+    uint8_t *host = paddr_host(paddr, len);
+    mtrace(paddr, len, data, true);
+    if (likely(host != NULL)) { host_write(host, len, data); pmem_set_dirty(paddr); pmem_check_code(paddr); }
+    else paddr_write(paddr, len, data);
+    return;
+  }
+  for (int i = 0; i < len; i ++) {
+    paddr_t paddr = vaddr_translate(addr + i, 1, MEM_TYPE_WRITE);
+    mtrace(paddr, 1, (uint8_t)(data >> (i * 8)), true);
+    paddr_write(paddr, 1, data >> (i * 8));
+  }
+}
+
+word_t vaddr_ifetch_slow(vaddr_t addr, int len) {
+  if (likely(isa_mmu_check(addr, len, MEM_TYPE_IFETCH) == MMU_DIRECT)) return paddr_read(addr, len);
+  return vaddr_read_translate(addr, len, MEM_TYPE_IFETCH);
+}
+
+word_t vaddr_read_slow(vaddr_t addr, int len) {
+  word_t ret;
+  if (likely(isa_mmu_check(addr, len, MEM_TYPE_READ) == MMU_DIRECT)) {
+    ret = paddr_read(addr, len);
+    mtrace(addr, len, ret, false);
+  } else {
+    ret = vaddr_read_translate(addr, len, MEM_TYPE_READ);
+  }
+  IFDEF(CONFIG_BTRACE, if (btrace_on) btrace_mem(addr, len, ret, false));
+  return ret;
+}
+
+void vaddr_write_slow(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_BTRACE, if (btrace_on) btrace_mem(addr, len, data, true));
+  if (likely(isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_DIRECT)) {
+    mtrace(addr, len, data, true);
+    paddr_write(addr, len, data);
+  } else {
+    vaddr_write_translate(addr, len, data);
+  }
+}
+
+// Translate page by page when the MMU is on.
+static void vaddr_bulk(vaddr_t addr, uint8_t *buf, size_t len, int type) {
+  if (isa_mmu_check(addr, len, type) == MMU_DIRECT) {
+    if (type == MEM_TYPE_WRITE) paddr_write_bulk(addr, buf, len);
+    else paddr_read_bulk(addr, buf, len);
+    return;
+  }
+  while (len > 0) {
+    size_t n = PAGE_SIZE - (addr & PAGE_MASK);
+    if (n > len) n = len;
+    paddr_t paddr = vaddr_translate(addr, 1, type);
+    if (type == MEM_TYPE_WRITE) paddr_write_bulk(paddr, buf, n);
+    else paddr_read_bulk(paddr, buf, n);
+    addr += n; buf += n; len -= n;
+  }
+}
+
+void vaddr_read_bulk(vaddr_t addr, void *buf, size_t len) {
+  vaddr_bulk(addr, buf, len, MEM_TYPE_READ);
+}
+
+void vaddr_write_bulk(vaddr_t addr, const void *buf, size_t len) {
+  vaddr_bulk(addr, (uint8_t *)buf, len, MEM_TYPE_WRITE);
+}
+
+paddr_t vaddr_mark_code(vaddr_t pc) {
+  paddr_t paddr = (isa_mmu_check(pc, 4, MEM_TYPE_IFETCH) == MMU_DIRECT ? pc :
+      vaddr_translate(pc, 4, MEM_TYPE_IFETCH));
+  // an instruction out of pmem is reported by the fetch
+  if (in_pmem(paddr)) pmem_mark_code(paddr);
+  return paddr;
 }
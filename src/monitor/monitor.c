@@ -18,6 +18,9 @@
 
 void init_rand();
 void init_log(const char *log_file);
+void init_btrace(const char *file);
+void init_mtrace(const char *ranges);
+void init_vga_capture(const char *file);
 void init_mem();
 void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
@@ -44,6 +47,9 @@ static void welcome() {
 void sdb_set_batch_mode();
 
 static char *log_file = NULL;
+static char *btrace_file = NULL;
+static char *mtrace_ranges = NULL;
+static char *vga_capture_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
@@ -62,7 +68,16 @@ static long load_img() {
 
   Log("The image is %s, size = %ld", img_file, size);
 
+#ifdef CONFIG_PMEM_MMAP_IMAGE
+  if (pmem_map_file(RESET_VECTOR, fileno(fp), size)) {
+    fclose(fp);
+    return size;
+  }
+  Log("Can not map the image, read it instead");
+#endif
+
   fseek(fp, 0, SEEK_SET);
+  pmem_prefault(RESET_VECTOR, size);
   int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
   assert(ret == 1);
 
@@ -74,13 +89,16 @@ static int parse_args(int argc, char *argv[]) {
   const struct option table[] = {
       {"batch", no_argument, NULL, 'b'},
       {"log", required_argument, NULL, 'l'},
+      {"btrace", required_argument, NULL, 't'},
+      {"mtrace", required_argument, NULL, 'm'},
+      {"vga-capture", required_argument, NULL, 'c'},
       {"diff", required_argument, NULL, 'd'},
       {"port", required_argument, NULL, 'p'},
       {"help", no_argument, NULL, 'h'},
       {0, 0, NULL, 0},
   };
   int o;
-  while ((o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ((o = getopt_long(argc, argv, "-bhl:t:m:c:d:p:", table, NULL)) != -1) {
     switch (o) {
     case 'b':
       sdb_set_batch_mode();
@@ -91,6 +109,15 @@ static int parse_args(int argc, char *argv[]) {
     case 'l':
       log_file = optarg;
       break;
+    case 't':
+      btrace_file = optarg;
+      break;
+    case 'm':
+      mtrace_ranges = optarg;
+      break;
+    case 'c':
+      vga_capture_file = optarg;
+      break;
     case 'd':
       diff_so_file = optarg;
       break;
@@ -101,6 +128,9 @@ static int parse_args(int argc, char *argv[]) {
       printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
       printf("\t-b,--batch              run with batch mode\n");
       printf("\t-l,--log=FILE           output log to FILE\n");
+      printf("\t-t,--btrace=FILE        output binary trace to FILE\n");
+      printf("\t-m,--mtrace=LO-HI[,...] only trace memory accesses to the physical address ranges\n");
+      printf("\t-c,--vga-capture=FILE   capture the screen to FILE instead of showing it\n");
       printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
       printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
       printf("\n");
@@ -122,6 +152,15 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Open the binary trace. */
+  IFDEF(CONFIG_BTRACE, init_btrace(btrace_file));
+
+  /* Set the ranges for the memory tracer. */
+  IFDEF(CONFIG_MTRACE, init_mtrace(mtrace_ranges));
+
+  /* Set the file to capture the screen. */
+  IFDEF(CONFIG_VGA_CAPTURE, init_vga_capture(vga_capture_file));
+
   /* Initialize memory. */
   init_mem();
 
@@ -80,6 +80,10 @@ static int cmd_w(char *args);
 
 static int cmd_d(char *args);
 
+#ifdef CONFIG_MTRACE
+static int cmd_mtrace(char *args);
+#endif
+
 static struct {
   const char *name;
   const char *description;
@@ -105,6 +109,12 @@ static struct {
      cmd_p},
     {"w", "Set a watchpoint for EXPR", cmd_w},
     {"d", "Delet watchpoint with number N", cmd_d},
+#ifdef CONFIG_MTRACE
+    {"mtrace",
+     "Trace memory accesses to physical address ranges: mtrace [on | off | "
+     "add LO HI | clear]. List the ranges without arguments.",
+     cmd_mtrace},
+#endif
 }; //数据定义
 #define NR_CMD ARRLEN(cmd_table)
 //函数定义
@@ -175,9 +185,13 @@ static int cmd_x(char *args) {
     printf("Invalid expression:%s\n", expr_str);
     return 0;
   }
-  for (int i = 0; i < n; i++) {
-    uint32_t data = paddr_read(addr + i * 4, 4);
-    printf("0x%08x: 0x%08x\n", addr + i * 4, data);
+  uint32_t data[64]; // 按块读取，每块最多64个单元
+  for (int i = 0; i < n; i += ARRLEN(data)) {
+    int nr = (n - i < ARRLEN(data) ? n - i : ARRLEN(data));
+    paddr_read_bulk(addr + i * 4, data, nr * 4);
+    for (int k = 0; k < nr; k++) {
+      printf("0x%08x: 0x%08x\n", addr + (i + k) * 4, data[k]);
+    }
   }
 
   return 0;
@@ -203,6 +217,10 @@ static int cmd_w(char *args) {
     printf("w EXPR\n");
     return 0;
   }
+#ifndef CONFIG_WATCHPOINT
+  printf("Watchpoints are disabled in menuconfig.\n");
+  return 0;
+#endif
   bool success = true;
   word_t num = expr(args, &success); //计算表达式的值
 
@@ -243,6 +261,31 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+#ifdef CONFIG_MTRACE
+static int cmd_mtrace(char *args) {
+  char *op = (args == NULL ? NULL : strtok(args, " "));
+  if (op == NULL) {
+    mtrace_display();
+  } else if (strcmp(op, "on") == 0) {
+    mtrace_set(true);
+  } else if (strcmp(op, "off") == 0) {
+    mtrace_set(false);
+  } else if (strcmp(op, "clear") == 0) {
+    mtrace_clear();
+  } else if (strcmp(op, "add") == 0) {
+    char *lo = strtok(NULL, " ");
+    char *hi = strtok(NULL, " ");
+    if (lo == NULL || hi == NULL ||
+        !mtrace_add(strtoull(lo, NULL, 0), strtoull(hi, NULL, 0))) {
+      printf("mtrace add LO HI\n");
+    }
+  } else {
+    printf("Unknown mtrace operation '%s'\n", op);
+  }
+  return 0;
+}
+#endif
+
 void sdb_set_batch_mode() { is_batch_mode = true; }
 
 void sdb_mainloop() {
@@ -0,0 +1,189 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <btrace-def.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* Records are encoded into one of NR_BUF buffers by the CPU thread.
+ * A full buffer is handed over to the writer thread by setting `full`,
+ * and is given back after it is written to the file. The CPU thread
+ * only waits when the writer falls behind by all the buffers.
+ */
+#define NR_BUF 4
+#define BUF_SIZE CONFIG_BTRACE_BUF_SIZE
+// larger than the encoding of any record
+#define MAX_RECORD_SIZE 128
+#define NR_DEV 32
+
+typedef struct {
+  uint8_t data[BUF_SIZE];
+  size_t len;
+  atomic_bool full;
+} BTraceBuf;
+
+static BTraceBuf btrace_buf[NR_BUF] = {};
+static int btrace_cur = 0;
+static uint8_t *btrace_p = NULL;
+static uint8_t *btrace_limit = NULL; // submit the buffer once btrace_p passes here
+
+static FILE *btrace_fp = NULL;
+static pthread_t btrace_thread;
+static atomic_bool btrace_exit = false;
+bool btrace_on = false;
+
+// state of the delta encoding
+static vaddr_t btrace_next_pc = 0;
+static vaddr_t btrace_last_addr = 0;
+static vaddr_t btrace_last_pmem_pc = 0;
+static paddr_t btrace_last_pmem_addr = 0;
+static const char *btrace_dev_name[NR_DEV] = {};
+static int btrace_nr_dev = 0;
+
+static void *btrace_writer(void *arg) {
+  int i = 0;
+  while (true) {
+    // load the flag first, buffers submitted before exiting are still written
+    bool exiting = atomic_load(&btrace_exit);
+    BTraceBuf *b = &btrace_buf[i];
+    if (atomic_load(&b->full)) {
+      fwrite(b->data, 1, b->len, btrace_fp);
+      atomic_store(&b->full, false);
+      i = (i + 1) % NR_BUF;
+    } else if (exiting) {
+      break;
+    } else {
+      usleep(100);
+    }
+  }
+  return NULL;
+}
+
+static void btrace_submit() {
+  BTraceBuf *b = &btrace_buf[btrace_cur];
+  b->len = btrace_p - b->data;
+  atomic_store(&b->full, true);
+
+  btrace_cur = (btrace_cur + 1) % NR_BUF;
+  b = &btrace_buf[btrace_cur];
+  while (atomic_load(&b->full)) sched_yield();
+  btrace_p = b->data;
+  btrace_limit = b->data + BUF_SIZE - MAX_RECORD_SIZE;
+}
+
+static inline void put_u(uint64_t x) {
+  while (x >= 0x80) {
+    *btrace_p ++ = (x & 0x7f) | 0x80;
+    x >>= 7;
+  }
+  *btrace_p ++ = x;
+}
+
+static inline void put_s(int64_t x) {
+  put_u(((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+}
+
+static inline void begin_record() {
+  if (unlikely(btrace_p > btrace_limit)) btrace_submit();
+}
+
+void btrace_inst(vaddr_t pc, const uint8_t *inst, int len) {
+  begin_record();
+  uint8_t tag = BTRACE_INST | ((len - 1) << 2);
+  if (pc != btrace_next_pc) {
+    *btrace_p ++ = tag | BTRACE_INST_JUMP;
+    put_s((sword_t)(pc - btrace_next_pc));
+  } else {
+    *btrace_p ++ = tag;
+  }
+  memcpy(btrace_p, inst, len);
+  btrace_p += len;
+  btrace_next_pc = pc + len;
+}
+
+void btrace_mem(vaddr_t addr, int len, word_t data, bool is_write) {
+  begin_record();
+  *btrace_p ++ = BTRACE_MEM | (is_write ? BTRACE_WRITE : 0) | (__builtin_ctz(len) << 3);
+  put_s((sword_t)(addr - btrace_last_addr));
+  put_u(data);
+  btrace_last_addr = addr;
+}
+
+void btrace_dev(const char *name, paddr_t base, paddr_t offset, int len, word_t data, bool is_write) {
+  begin_record();
+  int id;
+  for (id = 0; id < btrace_nr_dev; id ++) {
+    if (btrace_dev_name[id] == name) break;
+  }
+  if (id == btrace_nr_dev) {
+    Assert(btrace_nr_dev < NR_DEV, "too many devices to trace");
+    btrace_dev_name[btrace_nr_dev ++] = name;
+    *btrace_p ++ = BTRACE_MAP;
+    put_u(id);
+    put_u(base);
+    int n = strnlen(name, BTRACE_MAX_NAME - 1);
+    memcpy(btrace_p, name, n);
+    btrace_p[n] = '\0';
+    btrace_p += n + 1;
+  }
+  *btrace_p ++ = BTRACE_DEV | (is_write ? BTRACE_WRITE : 0) | (__builtin_ctz(len) << 3);
+  put_u(id);
+  put_u(offset);
+  put_u(data);
+}
+
+bool btrace_pmem(vaddr_t pc, paddr_t addr, int len, word_t data, bool is_write) {
+  if (btrace_fp == NULL) return false;
+  begin_record();
+  *btrace_p ++ = BTRACE_MAP | BTRACE_PMEM | (is_write ? BTRACE_WRITE : 0) | (__builtin_ctz(len) << 5);
+  put_s((sword_t)(pc - btrace_last_pmem_pc));
+  put_s((int64_t)((uint64_t)addr - (uint64_t)btrace_last_pmem_addr));
+  put_u(data);
+  btrace_last_pmem_pc = pc;
+  btrace_last_pmem_addr = addr;
+  return true;
+}
+
+void btrace_close() {
+  if (btrace_fp == NULL) return;
+  btrace_on = false;
+  btrace_submit();
+  atomic_store(&btrace_exit, true);
+  pthread_join(btrace_thread, NULL);
+  fclose(btrace_fp);
+  btrace_fp = NULL;
+}
+
+void init_btrace(const char *file) {
+  if (file == NULL) return;
+  btrace_fp = fopen(file, "wb");
+  Assert(btrace_fp, "Can not open '%s'", file);
+
+  BTraceHeader h = {};
+  strcpy(h.magic, BTRACE_MAGIC);
+  strncpy(h.isa, str(__GUEST_ISA__), sizeof(h.isa) - 1);
+  fwrite(&h, sizeof(h), 1, btrace_fp);
+
+  btrace_p = btrace_buf[0].data;
+  btrace_limit = btrace_p + BUF_SIZE - MAX_RECORD_SIZE;
+  int ret = pthread_create(&btrace_thread, NULL, btrace_writer, NULL);
+  Assert(ret == 0, "Can not create the thread to write the binary trace");
+  btrace_on = true;
+  atexit(btrace_close);
+  Log("Binary trace is written to %s", file);
+}
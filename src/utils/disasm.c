@@ -16,6 +16,7 @@
 #include <dlfcn.h>
 #include <capstone/capstone.h>
 #include <common.h>
+#include <ctype.h>
 
 static size_t (*cs_disasm_dl)(csh handle, const uint8_t *code,
     size_t code_size, uint64_t address, size_t count, cs_insn **insn);
@@ -59,13 +60,75 @@ void init_disasm() {
 #endif
 }
 
-void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
-	cs_insn *insn;
-	size_t count = cs_disasm_dl(handle, code, nbyte, pc, 0, &insn);
-  assert(count == 1);
+/* Disassembly results are memoized, since traces repeat a small number of
+ * encodings. An operand which depends on the pc (e.g. a branch target) is
+ * kept as an offset from the pc, and is printed at `pos` of the text.
+ */
+#define NR_DISASM_CACHE 16384
+// distance between the two pcs to find the operand which depends on the pc
+#define DISASM_PC_DELTA 0x1000
+
+typedef struct {
+  uint8_t code[16];
+  int nbyte;          // 0 if the entry is not valid
+  bool cacheable;     // false if the pc-dependent operand can not be found
+  int pos;            // -1 if no operand depends on the pc
+  int64_t pc_offset;
+  char text[192];     // "mnemonic\top_str" without the pc-dependent operand
+} DisasmEntry;
+
+static DisasmEntry disasm_cache[NR_DISASM_CACHE] = {};
+
+static bool disasm_at(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  cs_insn *insn;
+  size_t count = cs_disasm_dl(handle, code, nbyte, pc, 0, &insn);
+  if (count != 1) return false;
   int ret = snprintf(str, size, "%s", insn->mnemonic);
   if (insn->op_str[0] != '\0') {
     snprintf(str + ret, size - ret, "\t%s", insn->op_str);
   }
   cs_free_dl(insn, count);
+  return true;
+}
+
+static void disasm_fill(DisasmEntry *e, uint64_t pc, uint8_t *code, int nbyte) {
+  char text_b[sizeof(e->text)];
+  memcpy(e->code, code, nbyte);
+  e->nbyte = nbyte;
+  e->pos = -1;
+  e->cacheable = disasm_at(e->text, sizeof(e->text), pc, code, nbyte) &&
+    disasm_at(text_b, sizeof(text_b), pc + DISASM_PC_DELTA, code, nbyte);
+  if (!e->cacheable || strcmp(e->text, text_b) == 0) return;
+
+  // find the number which differs by DISASM_PC_DELTA
+  e->cacheable = false;
+  int i = 0;
+  while (e->text[i] == text_b[i]) i ++;
+  while (i > 0 && (isxdigit(e->text[i - 1]) || e->text[i - 1] == 'x')) i --;
+  char *end, *end_b;
+  uint64_t target = strtoull(e->text + i, &end, 0);
+  uint64_t target_b = strtoull(text_b + i, &end_b, 0);
+  if (end == e->text + i || target_b - target != DISASM_PC_DELTA || strcmp(end, end_b) != 0) return;
+  memmove(e->text + i, end, strlen(end) + 1);
+  e->pos = i;
+  e->pc_offset = target - pc;
+  e->cacheable = true;
+}
+
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  uint32_t h = nbyte;
+  for (int i = 0; i < nbyte; i ++) h = h * 31 + code[i];
+  DisasmEntry *e = &disasm_cache[(h ^ (h >> 14)) & (NR_DISASM_CACHE - 1)];
+  if (e->nbyte != nbyte || memcmp(e->code, code, nbyte) != 0) disasm_fill(e, pc, code, nbyte);
+
+  if (!e->cacheable) {
+    if (!disasm_at(str, size, pc, code, nbyte)) snprintf(str, size, "(bad)");
+  } else if (e->pos < 0) {
+    snprintf(str, size, "%s", e->text);
+  } else {
+    word_t target = pc + e->pc_offset;
+    // print the target like capstone does
+    snprintf(str, size, (target > 9 ? "%.*s0x%" PRIx64 "%s" : "%.*s%" PRIu64 "%s"),
+        e->pos, e->text, (uint64_t)target, e->text + e->pos);
+  }
 }
@@ -22,3 +22,17 @@ src/utils/disasm.c: $(LIBCAPSTONE)
 $(LIBCAPSTONE):
 	$(MAKE) -C tools/capstone
 endif
+
+ifndef CONFIG_ITRACE
+SRCS-BLACKLIST-y += src/utils/itrace.c
+endif
+
+ifndef CONFIG_MTRACE
+SRCS-BLACKLIST-y += src/utils/mtrace.c
+endif
+
+ifdef CONFIG_BTRACE
+LIBS += -lpthread
+else
+SRCS-BLACKLIST-y += src/utils/btrace.c
+endif
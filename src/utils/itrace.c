@@ -0,0 +1,61 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+
+void itrace_format(char *buf, int size, const ITraceRecord *r) {
+  char *p = buf;
+  char *end = buf + size;
+  p += snprintf(p, end - p, FMT_WORD ":", r->pc);
+  int ilen = r->len;
+  int i;
+#ifdef CONFIG_ISA_x86
+  for (i = 0; i < ilen; i++) {
+#else
+  for (i = ilen - 1; i >= 0; i--) {
+#endif
+    p += snprintf(p, end - p, " %02x", r->inst[i]);
+  }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - ilen;
+  if (space_len < 0)
+    space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+  disassemble(p, end - p, MUXDEF(CONFIG_ISA_x86, r->pc + ilen, r->pc),
+              (uint8_t *)r->inst, ilen);
+}
+
+#ifdef CONFIG_IRINGBUF
+ITraceRecord iringbuf[CONFIG_IRINGBUF_SIZE] = {};
+int iringbuf_idx = 0; // where the next instruction is recorded
+
+void iringbuf_dump() {
+  char buf[128];
+  int i = iringbuf_idx;
+  printf("Recently executed instructions:\n");
+  do {
+    ITraceRecord *r = &iringbuf[i];
+    if (++ i == CONFIG_IRINGBUF_SIZE) i = 0;
+    if (r->len == 0) continue; // not used yet
+    itrace_format(buf, sizeof(buf), r);
+    printf("%s %s\n", (i == iringbuf_idx ? "-->" : "   "), buf);
+  } while (i != iringbuf_idx);
+}
+#endif
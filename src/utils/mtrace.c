@@ -0,0 +1,119 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+#define NR_RANGE 16
+// the longest access, so that one starting before a range is checked
+#define MAX_ACCESS_LEN 8
+
+typedef struct {
+  paddr_t lo, hi; // [lo, hi]
+} MTraceRange;
+
+// sorted, and neither overlapped nor adjacent
+static MTraceRange range[NR_RANGE] = {};
+static int nr_range = 0;
+static bool mtrace_enable = false;
+paddr_t mtrace_lo = 0, mtrace_span = 0;
+
+static void update_bound() {
+  if (!mtrace_enable || nr_range == 0) {
+    mtrace_lo = 0;
+    mtrace_span = 0;
+    return;
+  }
+  paddr_t lo = range[0].lo;
+  mtrace_lo = (lo < MAX_ACCESS_LEN - 1 ? 0 : lo - (MAX_ACCESS_LEN - 1));
+  mtrace_span = range[nr_range - 1].hi - mtrace_lo + 1;
+  if (mtrace_span == 0) mtrace_span = (paddr_t)-1; // the whole address space
+}
+
+void mtrace_set(bool enable) {
+  mtrace_enable = enable;
+  update_bound();
+}
+
+bool mtrace_add(paddr_t lo, paddr_t hi) {
+  if (lo > hi || nr_range == NR_RANGE) return false;
+  int i;
+  for (i = nr_range; i > 0 && range[i - 1].lo > lo; i --) range[i] = range[i - 1];
+  range[i] = (MTraceRange){ .lo = lo, .hi = hi };
+  nr_range ++;
+
+  // merge the overlapped and adjacent ranges
+  int n = 1;
+  for (i = 1; i < nr_range; i ++) {
+    MTraceRange *last = &range[n - 1];
+    if (range[i].lo <= last->hi || range[i].lo - last->hi == 1) {
+      if (range[i].hi > last->hi) last->hi = range[i].hi;
+    } else {
+      range[n ++] = range[i];
+    }
+  }
+  nr_range = n;
+  update_bound();
+  return true;
+}
+
+void mtrace_clear() {
+  nr_range = 0;
+  update_bound();
+}
+
+void mtrace_display() {
+  printf("mtrace is %s\n", (mtrace_enable ? "on" : "off"));
+  for (int i = 0; i < nr_range; i ++) {
+    printf("[" FMT_PADDR ", " FMT_PADDR "]\n", range[i].lo, range[i].hi);
+  }
+}
+
+void mtrace_record(paddr_t addr, int len, word_t data, bool is_write) {
+  // find the first range ending at or after addr
+  int l = 0, r = nr_range;
+  while (l < r) {
+    int m = (l + r) / 2;
+    if (range[m].hi < addr) l = m + 1;
+    else r = m;
+  }
+  if (l == nr_range || range[l].lo > addr + len - 1) return;
+
+  if (MUXDEF(CONFIG_BTRACE, btrace_pmem(cpu.pc, addr, len, data, is_write), false)) return;
+  // not limited by TRACE_START and TRACE_END like log_write()
+  extern FILE *log_fp;
+  if (log_fp != NULL) {
+    fprintf(log_fp, "[mtrace] pc = " FMT_WORD " %s " FMT_PADDR " [%d] = " FMT_WORD "\n",
+        cpu.pc, (is_write ? "write" : "read "), addr, len, data);
+  }
+}
+
+// parse "LO-HI[,LO-HI]..."
+void init_mtrace(const char *ranges) {
+  if (ranges == NULL) return;
+  const char *p = ranges;
+  while (*p != '\0') {
+    char *end;
+    paddr_t lo = strtoull(p, &end, 0);
+    Assert(*end == '-', "bad mtrace ranges '%s'", ranges);
+    paddr_t hi = strtoull(end + 1, &end, 0);
+    Assert(*end == ',' || *end == '\0', "bad mtrace ranges '%s'", ranges);
+    Assert(mtrace_add(lo, hi), "can not trace [" FMT_PADDR ", " FMT_PADDR "]", lo, hi);
+    p = (*end == ',' ? end + 1 : end);
+  }
+  mtrace_set(true);
+  // only the accesses to the ranges are wanted in the binary trace
+  IFDEF(CONFIG_BTRACE, btrace_on = false);
+  Log("Memory accesses to %s are traced", ranges);
+}
@@ -0,0 +1,212 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Convert the binary trace written by NEMU with --btrace to text, and
+ * disassemble the instructions in it. See include/btrace-def.h for the
+ * format.
+ *
+ * Usage: btrace-dump FILE
+ */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <capstone/capstone.h>
+#include <btrace-def.h>
+
+static FILE *fp = NULL;
+static csh handle;
+static size_t (*cs_disasm_dl)(csh handle, const uint8_t *code,
+    size_t code_size, uint64_t address, size_t count, cs_insn **insn);
+static void (*cs_free_dl)(cs_insn *insn, size_t count);
+static bool is_x86 = false;
+static int addr_width = 8;
+static uint64_t addr_mask = 0xffffffff;
+
+// Memory and device records precede the instruction which makes them,
+// so they are printed after it.
+static char pending[4096];
+static int pending_len = 0;
+
+#define defer(...) do { \
+  if (pending_len < sizeof(pending)) \
+    pending_len += snprintf(pending + pending_len, sizeof(pending) - pending_len, __VA_ARGS__); \
+} while (0)
+
+static void flush_pending() {
+  if (pending_len > sizeof(pending) - 1) pending_len = sizeof(pending) - 1;
+  fwrite(pending, 1, pending_len, stdout);
+  pending_len = 0;
+}
+
+static int get_byte() {
+  int c = fgetc(fp);
+  if (c == EOF) {
+    fprintf(stderr, "unexpected end of the trace\n");
+    exit(1);
+  }
+  return c;
+}
+
+static uint64_t get_u() {
+  uint64_t x = 0;
+  int shift = 0, c;
+  do {
+    c = get_byte();
+    x |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return x;
+}
+
+static int64_t get_s() {
+  uint64_t x = get_u();
+  return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+static void init_disasm(const char *isa) {
+  cs_arch arch;
+  cs_mode mode;
+  if (strcmp(isa, "x86") == 0) { arch = CS_ARCH_X86; mode = CS_MODE_32; is_x86 = true; }
+  else if (strcmp(isa, "mips32") == 0) { arch = CS_ARCH_MIPS; mode = CS_MODE_MIPS32; }
+  else if (strcmp(isa, "riscv32") == 0) { arch = CS_ARCH_RISCV; mode = CS_MODE_RISCV32 | CS_MODE_RISCVC; }
+  else if (strcmp(isa, "riscv64") == 0) { arch = CS_ARCH_RISCV; mode = CS_MODE_RISCV64 | CS_MODE_RISCVC; addr_width = 16; addr_mask = -1; }
+  else if (strcmp(isa, "loongarch32r") == 0) { arch = CS_ARCH_LOONGARCH; mode = CS_MODE_LOONGARCH32; }
+  else {
+    fprintf(stderr, "unsupported ISA '%s'\n", isa);
+    exit(1);
+  }
+
+  // load capstone like src/utils/disasm.c does
+  void *dl_handle = dlopen(LIBCAPSTONE, RTLD_LAZY);
+  if (dl_handle == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(1);
+  }
+  cs_err (*cs_open_dl)(cs_arch arch, cs_mode mode, csh *handle) = dlsym(dl_handle, "cs_open");
+  cs_err (*cs_option_dl)(csh handle, cs_opt_type type, size_t value) = dlsym(dl_handle, "cs_option");
+  cs_disasm_dl = dlsym(dl_handle, "cs_disasm");
+  cs_free_dl = dlsym(dl_handle, "cs_free");
+  assert(cs_open_dl && cs_option_dl && cs_disasm_dl && cs_free_dl);
+
+  int ret = cs_open_dl(arch, mode, &handle);
+  assert(ret == CS_ERR_OK);
+  if (is_x86) cs_option_dl(handle, CS_OPT_SYNTAX, CS_OPT_SYNTAX_ATT);
+}
+
+// the same format as the instruction trace of NEMU
+static void print_inst(uint64_t pc, uint8_t *inst, int len) {
+  int i;
+  printf("0x%0*" PRIx64 ":", addr_width, pc);
+  if (is_x86) for (i = 0; i < len; i ++) printf(" %02x", inst[i]);
+  else for (i = len - 1; i >= 0; i --) printf(" %02x", inst[i]);
+  int space_len = (is_x86 ? 8 : 4) - len;
+  if (space_len < 0) space_len = 0;
+  printf("%*s", space_len * 3 + 1, "");
+
+  cs_insn *insn;
+  size_t count = cs_disasm_dl(handle, inst, len, (is_x86 ? pc + len : pc), 0, &insn);
+  if (count != 1) {
+    printf("(bad)\n");
+    return;
+  }
+  printf("%s%s%s\n", insn->mnemonic, (insn->op_str[0] != '\0' ? "\t" : ""), insn->op_str);
+  cs_free_dl(insn, count);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+    return 1;
+  }
+  fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  BTraceHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || strcmp(h.magic, BTRACE_MAGIC) != 0) {
+    fprintf(stderr, "%s is not a binary trace of NEMU\n", argv[1]);
+    return 1;
+  }
+  h.isa[sizeof(h.isa) - 1] = '\0';
+  init_disasm(h.isa);
+
+  char dev_name[256][BTRACE_MAX_NAME] = {};
+  uint64_t next_pc = 0, last_addr = 0, pmem_pc = 0, pmem_addr = 0;
+  int tag;
+  while ((tag = fgetc(fp)) != EOF) {
+    switch (tag & 0x3) {
+      case BTRACE_INST: {
+        uint8_t inst[16];
+        int len = ((tag >> 2) & 0xf) + 1;
+        uint64_t pc = next_pc;
+        if (tag & BTRACE_INST_JUMP) pc = (pc + get_s()) & addr_mask;
+        for (int i = 0; i < len; i ++) inst[i] = get_byte();
+        print_inst(pc, inst, len);
+        flush_pending();
+        next_pc = pc + len;
+        break;
+      }
+      case BTRACE_MEM: {
+        uint64_t addr = (last_addr + get_s()) & addr_mask;
+        uint64_t data = get_u();
+        defer("    mem %s 0x%0*" PRIx64 " [%d] = 0x%" PRIx64 "\n", (tag & BTRACE_WRITE ? "write" : "read "),
+            addr_width, addr, 1 << ((tag >> 3) & 0x3), data);
+        last_addr = addr;
+        break;
+      }
+      case BTRACE_DEV: {
+        uint64_t id = get_u();
+        uint64_t offset = get_u();
+        uint64_t data = get_u();
+        defer("    dev %s %s+0x%" PRIx64 " [%d] = 0x%" PRIx64 "\n", (tag & BTRACE_WRITE ? "write" : "read "),
+            (id < 256 ? dev_name[id] : "?"), offset, 1 << ((tag >> 3) & 0x3), data);
+        break;
+      }
+      case BTRACE_MAP: {
+        if (tag & BTRACE_PMEM) {
+          // not preceding any instruction record when only mtrace is on
+          pmem_pc += get_s();
+          pmem_addr += get_s();
+          uint64_t data = get_u();
+          printf("    pmem %s 0x%0*" PRIx64 " [%d] = 0x%" PRIx64 " at pc = 0x%0*" PRIx64 "\n",
+              (tag & BTRACE_WRITE ? "write" : "read "), addr_width, pmem_addr, 1 << ((tag >> 5) & 0x3),
+              data, addr_width, pmem_pc & addr_mask);
+          break;
+        }
+        uint64_t id = get_u();
+        uint64_t base = get_u();
+        char name[BTRACE_MAX_NAME];
+        int i = 0;
+        while ((name[i] = get_byte()) != '\0') {
+          if (i < BTRACE_MAX_NAME - 1) i ++;
+        }
+        name[i] = '\0';
+        if (id < 256) strcpy(dev_name[id], name);
+        defer("    dev %s at 0x%0*" PRIx64 "\n", name, addr_width, base);
+        break;
+      }
+    }
+  }
+  flush_pending();
+  fclose(fp);
+  return 0;
+}
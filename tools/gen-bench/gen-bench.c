@@ -0,0 +1,66 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Generate a riscv32 image to measure the simulation frequency of NEMU.
+ * The image is straight-line code made of the instructions implemented by
+ * src/isa/riscv32/inst.c (auipc, lbu, sb and ebreak), and ends with
+ * HIT GOOD TRAP.
+ *
+ * Usage: gen-bench [NR_INST] > image.bin
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum { ZERO = 0, T0 = 5, A0 = 10, A1 = 11 };
+
+static uint32_t auipc(int rd, uint32_t imm20) {
+  return (imm20 << 12) | (rd << 7) | 0x17;
+}
+
+static uint32_t lbu(int rd, int rs1, int imm) {
+  return ((imm & 0xfff) << 20) | (rs1 << 15) | (4 << 12) | (rd << 7) | 0x03;
+}
+
+static uint32_t sb(int rs2, int rs1, int imm) {
+  return (((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (0 << 12) |
+    ((imm & 0x1f) << 7) | 0x23;
+}
+
+static void emit(uint32_t inst) {
+  fwrite(&inst, sizeof(inst), 1, stdout);
+}
+
+int main(int argc, char *argv[]) {
+  long nr_inst = (argc > 1 ? atol(argv[1]) : 1000000);
+  // the data area is 16 MB after the code, which must not be larger than it
+  if (nr_inst < 4 || nr_inst > (16 << 20) / 4 - 4) {
+    fprintf(stderr, "NR_INST should be in [4, %d]\n", (16 << 20) / 4 - 4);
+    return 1;
+  }
+
+  emit(auipc(T0, 0x1000));
+  long i;
+  for (i = 0; i < nr_inst - 4; i ++) {
+    int off = (i / 2) & 0x7ff;
+    emit(i % 2 == 0 ? lbu(A1, T0, off) : sb(A1, T0, off + 1));
+  }
+  // a0 = 0 for HIT GOOD TRAP
+  emit(sb(ZERO, T0, 0));
+  emit(lbu(A0, T0, 0));
+  emit(0x00100073); // ebreak
+  return 0;
+}
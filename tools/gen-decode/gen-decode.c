@@ -0,0 +1,309 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Generate a decode tree for each INSTPAT_START()/INSTPAT_END() table in an
+ * `inst.c' of NEMU. Each inner node of the tree switches on a field of fixed
+ * opcode bits, so matching an instruction takes at most one lookup per level
+ * instead of trying the patterns one by one.
+ *
+ * Patterns are tried in order by INSTPAT(), and the tree keeps this
+ * semantics. A pattern which is fully covered by an earlier one can never
+ * match, and two patterns which partially overlap make the result depend on
+ * their order silently. Both are reported as errors. A pattern covering a
+ * later one (e.g. `inv') is fine.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+#define MAX_PATTERN 1024
+#define MAX_NODE 65536
+#define MAX_FIELD_BITS 8
+
+typedef struct {
+  uint64_t key, mask;
+  int line;
+  char name[64];
+} Pattern;
+
+// A node either looks up a field of `bits' bits at `shift', or tests
+// whether `(inst & mask) == key' if `mask' is not zero.
+typedef struct {
+  int shift, bits;
+  uint64_t key, mask;
+  int base;
+} Node;
+
+static const char *file = NULL;
+static Pattern pat[MAX_PATTERN];
+static int nr_pat = 0;
+
+static Node node[MAX_NODE];
+static int nr_node = 0;
+static int *entry = NULL;
+static int nr_entry = 0;
+static int max_depth = 0;
+
+static void error(int line, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "%s:%d: error: ", file, line);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
+
+/* Parse `INSTPAT("pattern", name, ...'. The last character of the pattern
+ * is bit 0 of the instruction, the same as pattern_decode().
+ */
+static void parse_pattern(const char *p, int line) {
+  if (nr_pat == MAX_PATTERN) error(line, "too many patterns");
+  Pattern *pt = &pat[nr_pat ++];
+  pt->line = line;
+  pt->key = pt->mask = 0;
+
+  const char *q = strchr(p, '"');
+  assert(q != NULL);
+  int nr_bit = 0;
+  for (p = q + 1; *p != '"'; p ++) {
+    if (*p == ' ') continue;
+    if (*p != '0' && *p != '1' && *p != '?') {
+      error(line, "invalid character in pattern string");
+    }
+    if (++ nr_bit > 64) error(line, "pattern too long");
+    pt->key  = (pt->key  << 1) | (*p == '1');
+    pt->mask = (pt->mask << 1) | (*p != '?');
+  }
+
+  p = strchr(p, ',');
+  if (p == NULL) error(line, "INSTPAT() should be written in one line");
+  for (p ++; *p == ' '; p ++);
+  int len = strcspn(p, " ,)");
+  if (len >= sizeof(pt->name)) len = sizeof(pt->name) - 1;
+  memcpy(pt->name, p, len);
+  pt->name[len] = '\0';
+}
+
+static void check_overlap() {
+  for (int j = 0; j < nr_pat; j ++) {
+    for (int i = 0; i < j; i ++) {
+      Pattern *a = &pat[i], *b = &pat[j];
+      uint64_t common = a->mask & b->mask;
+      if ((a->key ^ b->key) & common) continue; // disjoint
+      if ((a->mask & ~b->mask) == 0) {
+        // every instruction matched by `b' is matched by `a' first
+        error(b->line, "pattern `%s' is unreachable, it is covered by `%s' at line %d",
+            b->name, a->name, a->line);
+      }
+      if ((b->mask & ~a->mask) != 0) {
+        error(b->line, "pattern `%s' partially overlaps with `%s' at line %d, "
+            "the result depends on their order", b->name, a->name, a->line);
+      }
+    }
+  }
+}
+
+static int new_entries(int n) {
+  entry = realloc(entry, sizeof(int) * (nr_entry + n));
+  assert(entry);
+  nr_entry += n;
+  return nr_entry - n;
+}
+
+/* Build the subtree for the candidate patterns `cand' (in order), given
+ * that the bits in `tested' are already known. Return the entry value:
+ * a positive value is the index of an inner node, and a non-positive
+ * value `-k' means the k-th pattern is matched (k == nr_pat for none).
+ * The subtree is emitted as nested switch statements later.
+ */
+static int build(const int *cand, int nr_cand, uint64_t tested, int depth) {
+  if (nr_cand == 0) return -nr_pat;
+  Pattern *first = &pat[cand[0]];
+  uint64_t todo = first->mask & ~tested;
+  if (todo == 0) return -cand[0];
+
+  // Prefer the bits which are fixed in all the other candidates that still
+  // need testing, so that the field also separates them.
+  uint64_t field = todo;
+  int shared = 0;
+  for (int i = 1; i < nr_cand; i ++) {
+    uint64_t m = pat[cand[i]].mask & ~tested;
+    if (m != 0 && (field & m) != 0) { field &= m; shared = 1; }
+  }
+
+  if (!shared) {
+    // The remaining bits do not help to tell the other candidates apart,
+    // so just compare them at once instead of spending wide tables on them.
+    if (nr_node == MAX_NODE) error(first->line, "decode tree too large");
+    int id = nr_node ++;
+    int base = new_entries(2);
+    node[id] = (Node){ .key = first->key & todo, .mask = todo, .base = base };
+    if (depth + 1 > max_depth) max_depth = depth + 1;
+    entry[base + 0] = build(cand + 1, nr_cand - 1, tested, depth + 1);
+    entry[base + 1] = -cand[0];
+    return id;
+  }
+
+  // choose the longest run of contiguous bits in `field'
+  int best_shift = 0, best_bits = 0;
+  for (int lo = 0; lo < 64; ) {
+    if (!((field >> lo) & 1)) { lo ++; continue; }
+    int hi = lo;
+    while (hi < 64 && ((field >> hi) & 1)) hi ++;
+    if (hi - lo > best_bits) { best_shift = lo; best_bits = hi - lo; }
+    lo = hi;
+  }
+  if (best_bits > MAX_FIELD_BITS) best_bits = MAX_FIELD_BITS;
+  uint64_t fmask = ((1ull << best_bits) - 1) << best_shift;
+
+  if (nr_node == MAX_NODE) error(first->line, "decode tree too large");
+  int id = nr_node ++;
+  int base = new_entries(1 << best_bits);
+  node[id] = (Node){ .shift = best_shift, .bits = best_bits, .base = base };
+  if (depth + 1 > max_depth) max_depth = depth + 1;
+
+  int *sub = malloc(sizeof(int) * nr_cand);
+  assert(sub);
+  for (uint64_t v = 0; v < (1ull << best_bits); v ++) {
+    uint64_t val = v << best_shift;
+    int nr_sub = 0;
+    for (int i = 0; i < nr_cand; i ++) {
+      Pattern *p = &pat[cand[i]];
+      if (((p->key ^ val) & p->mask & fmask) == 0) sub[nr_sub ++] = cand[i];
+    }
+    int e = build(sub, nr_sub, tested | fmask, depth + 1);
+    entry[base + v] = e;
+  }
+  free(sub);
+  return id;
+}
+
+static void emit(int e, int indent) {
+  if (e <= 0) {
+    printf("%*sreturn %d;\n", indent, "", -e);
+    return;
+  }
+  Node *n = &node[e];
+  if (n->mask != 0) {
+    printf("%*sif ((inst & 0x%llx) == 0x%llx) return %d;\n", indent, "",
+        (unsigned long long)n->mask, (unsigned long long)n->key, -entry[n->base + 1]);
+    emit(entry[n->base], indent);
+    return;
+  }
+
+  // the most frequent result goes to `default', and inner nodes always
+  // have their own cases
+  int nr = 1 << n->bits;
+  int *ent = entry + n->base;
+  int dflt = INT_MIN, dflt_cnt = 0; // INT_MIN is not an entry
+  for (int v = 0; v < nr; v ++) {
+    if (ent[v] > 0) continue;
+    int cnt = 0;
+    for (int w = 0; w < nr; w ++) cnt += (ent[w] == ent[v]);
+    if (cnt > dflt_cnt) { dflt = ent[v]; dflt_cnt = cnt; }
+  }
+
+  printf("%*sswitch ((inst >> %d) & 0x%x) {\n", indent, "", n->shift, nr - 1);
+  for (int v = 0; v < nr; v ++) {
+    if (ent[v] == dflt) continue;
+    if (ent[v] <= 0) {
+      // merge the cases with the same result
+      int first = 1;
+      for (int w = 0; w < v; w ++) if (ent[w] == ent[v]) { first = 0; break; }
+      if (!first) continue;
+      for (int w = v; w < nr; w ++) {
+        if (ent[w] == ent[v]) printf("%*scase 0x%x:\n", indent + 2, "", w);
+      }
+      printf("%*sreturn %d;\n", indent + 4, "", -ent[v]);
+    } else {
+      printf("%*scase 0x%x:\n", indent + 2, "", v);
+      emit(ent[v], indent + 4);
+    }
+  }
+  if (dflt_cnt > 0) {
+    printf("%*sdefault:\n", indent + 2, "");
+    printf("%*sreturn %d;\n", indent + 4, "", -dflt);
+  }
+  printf("%*s}\n", indent, "");
+  if (dflt_cnt == 0) printf("%*sreturn %d;\n", indent, "", nr_pat);
+}
+
+static void gen_table(int start_line) {
+  check_overlap();
+
+  nr_node = 1; // a positive entry refers to an inner node
+  nr_entry = 0;
+  max_depth = 0;
+  int cand[MAX_PATTERN];
+  for (int i = 0; i < nr_pat; i ++) cand[i] = i;
+  int root = build(cand, nr_pat, 0, 0);
+
+  printf("\n// INSTPAT_START() at line %d: %d patterns, at most %d lookups\n",
+      start_line, nr_pat, max_depth);
+  printf("#define DECODE_TREE_TARGET_%d", start_line);
+  for (int i = 0; i < nr_pat; i ++) {
+    printf("%s \\\n  &&__instpat_line_%d /* %s */", (i == 0 ? "" : ","), pat[i].line, pat[i].name);
+  }
+  printf("\n\nstatic inline int decode_tree_%d(uint64_t inst) {\n", start_line);
+  emit(root, 2);
+  printf("}\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s inst.c > decode-tree.h\n", argv[0]);
+    return 1;
+  }
+  file = argv[1];
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) { perror(file); return 1; }
+
+  printf("// Generated by tools/gen-decode from %s. DO NOT EDIT.\n\n"
+         "#ifndef __DECODE_TREE_H__\n#define __DECODE_TREE_H__\n\n"
+         "#include <stdint.h>\n", file);
+
+  static char line[4096];
+  int lineno = 0, start_line = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno ++;
+    char *p = line;
+    while (*p == ' ' || *p == '\t') p ++;
+    if (*p == '#' || strncmp(p, "//", 2) == 0) continue;
+
+    if (strncmp(p, "INSTPAT_START(", 14) == 0) {
+      if (start_line != 0) error(lineno, "nested INSTPAT_START()");
+      start_line = lineno;
+      nr_pat = 0;
+    } else if (strncmp(p, "INSTPAT_END(", 12) == 0) {
+      if (start_line == 0) error(lineno, "INSTPAT_END() without INSTPAT_START()");
+      gen_table(start_line);
+      start_line = 0;
+    } else if (strncmp(p, "INSTPAT(", 8) == 0) {
+      if (start_line == 0) error(lineno, "INSTPAT() outside a table");
+      parse_pattern(p, lineno);
+    }
+  }
+  fclose(fp);
+  if (start_line != 0) error(start_line, "INSTPAT_START() without INSTPAT_END()");
+
+  printf("\n#endif\n");
+  return 0;
+}
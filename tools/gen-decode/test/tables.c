@@ -0,0 +1,116 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+/* Regression tables for gen-decode. `make test' generates the decode
+ * trees of this file, and checks them against matching the patterns one
+ * by one in order, for every value of the bits fixed in the patterns.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "decode-tree.h"
+
+#define concat_temp(x, y) x ## y
+#define concat(x, y) concat_temp(x, y)
+
+static int match(const char *p, uint64_t inst, int width) {
+  for (int bit = width - 1; *p != '\0'; p ++) {
+    if (*p == ' ') continue;
+    if (*p != '?' && (*p - '0') != ((inst >> bit) & 1)) return 0;
+    bit --;
+  }
+  return 1;
+}
+
+static int check(int line, int (*tree)(uint64_t), const char **pats, int nr_pat) {
+  // the bits which are not fixed in any pattern do not change the result
+  int width = 0;
+  for (const char *p = pats[0]; *p != '\0'; p ++) width += (*p != ' ');
+  uint64_t fixed = 0;
+  for (int i = 0; i < nr_pat; i ++) {
+    int bit = width - 1;
+    for (const char *p = pats[i]; *p != '\0'; p ++) {
+      if (*p == ' ') continue;
+      if (*p != '?') fixed |= 1ull << bit;
+      bit --;
+    }
+  }
+  uint64_t inst = 0;
+  do {
+    int expect = 0;
+    while (expect < nr_pat && !match(pats[expect], inst, width)) expect ++;
+    int got = tree(inst);
+    if (got != expect) {
+      printf("table at line %d: inst = 0x%llx, expected %d, got %d\n",
+          line, (unsigned long long)inst, expect, got);
+      return 1;
+    }
+    inst = (inst - fixed) & fixed; // the next subset of `fixed'
+  } while (inst != 0);
+  return 0;
+}
+
+static int nr_fail = 0;
+
+#define INSTPAT_START() \
+  const int line = __LINE__; \
+  int (*tree)(uint64_t) = concat(decode_tree_, __LINE__); \
+  const char *pats[64]; \
+  int nr_pat = 0
+#define INSTPAT(pattern, ...) pats[nr_pat ++] = pattern
+#define INSTPAT_END() nr_fail += check(line, tree, pats, nr_pat)
+
+// every entry of the root switch is an inner node
+static void table_inner() {
+  INSTPAT_START();
+  INSTPAT("1100", a);
+  INSTPAT("1?01", b);
+  INSTPAT("1?10", c);
+  INSTPAT("1?11", d);
+  INSTPAT("????", inv);
+  INSTPAT_END();
+}
+
+// inner nodes mixed with leaves, and no pattern for some instructions
+static void table_mixed() {
+  INSTPAT_START();
+  INSTPAT("00 ??? 000", a);
+  INSTPAT("00 ??? 001", b);
+  INSTPAT("01 1?? 0?1", c);
+  INSTPAT("01 0?? ???", d);
+  INSTPAT("10 ??? ???", e);
+  INSTPAT_END();
+}
+
+// a riscv-like table
+static void table_riscv() {
+  INSTPAT_START();
+  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu);
+  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb);
+  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc);
+  INSTPAT("??????? ????? ????? 000 ????? 00111 11", jal);
+  INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv);
+  INSTPAT_END();
+}
+
+int main() {
+  table_inner();
+  table_mixed();
+  table_riscv();
+  printf("%s\n", nr_fail == 0 ? "PASS" : "FAIL");
+  return nr_fail != 0;
+}
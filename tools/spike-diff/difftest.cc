@@ -72,9 +72,21 @@ void sim_t::diff_set_regs(void* diff_context) {
 
 void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
   mmu_t* mmu = p->get_mmu();
-  for (size_t i = 0; i < n; i++) {
-    mmu->store<uint8_t>(dest+i, *((uint8_t*)src+i));
+  // the memory of spike is allocated page by page
+  for (size_t i = 0; i < n; ) {
+    reg_t addr = dest + i;
+    size_t len = std::min<size_t>(n - i, PGSIZE - (addr % PGSIZE));
+    char* host = addr_to_mem(addr);
+    if (host != NULL) {
+      memcpy(host, (uint8_t*)src + i, len);
+    } else {
+      for (size_t k = 0; k < len; k++) mmu->store<uint8_t>(addr + k, *((uint8_t*)src + i + k));
+    }
+    i += len;
   }
+  // the memory is written behind the caches of the MMU
+  mmu->flush_icache();
+  mmu->flush_tlb();
 }
 
 extern "C" {
@@ -0,0 +1,150 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Convert the screen capture written by NEMU with --vga-capture to a Y4M
+ * video on stdout, with the frame rate of the capture. A frame is repeated
+ * until the time of the next one, so the video plays in real time. See
+ * include/vcap-def.h for the format.
+ *
+ * Usage: vcap-dump FILE > OUT.y4m
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vcap-def.h>
+
+static FILE *fp = NULL;
+static const char *file = NULL;
+
+static void get(void *buf, size_t len) {
+  if (fread(buf, 1, len, fp) != len) {
+    fprintf(stderr, "unexpected end of %s\n", file);
+    exit(1);
+  }
+}
+
+static uint64_t get_u(const uint8_t **p, const uint8_t *end) {
+  uint64_t x = 0;
+  int shift = 0;
+  uint8_t c;
+  do {
+    if (*p >= end) {
+      fprintf(stderr, "bad frame in %s\n", file);
+      exit(1);
+    }
+    c = *(*p) ++;
+    x |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return x;
+}
+
+static void apply(uint32_t *pixels, uint64_t nr_pixel, const uint8_t *p, const uint8_t *end) {
+  uint64_t i = 0;
+  while (p < end) {
+    uint64_t x = get_u(&p, end);
+    uint64_t n = x >> 2;
+    int type = x & 0x3;
+    if (i + n > nr_pixel || (type == VCAP_FILL && end - p < 4) ||
+        (type == VCAP_COPY && (uint64_t)(end - p) < n * 4) || type > VCAP_COPY) {
+      fprintf(stderr, "bad frame in %s\n", file);
+      exit(1);
+    }
+    switch (type) {
+      case VCAP_SKIP: break;
+      case VCAP_FILL: {
+        uint32_t pixel;
+        memcpy(&pixel, p, 4);
+        p += 4;
+        for (uint64_t k = 0; k < n; k ++) pixels[i + k] = pixel;
+        break;
+      }
+      case VCAP_COPY: memcpy(&pixels[i], p, n * 4); p += n * 4; break;
+    }
+    i += n;
+  }
+}
+
+// BT.601 with limited range, in the 4:4:4 planes of a Y4M frame
+static void put_frame(const uint32_t *pixels, uint64_t nr_pixel, uint8_t *yuv) {
+  uint8_t *y = yuv, *u = yuv + nr_pixel, *v = yuv + nr_pixel * 2;
+  for (uint64_t i = 0; i < nr_pixel; i ++) {
+    int r = (pixels[i] >> 16) & 0xff, g = (pixels[i] >> 8) & 0xff, b = pixels[i] & 0xff;
+    y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+  printf("FRAME\n");
+  fwrite(yuv, 1, nr_pixel * 3, stdout);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s FILE > OUT.y4m\n", argv[0]);
+    return 1;
+  }
+  file = argv[1];
+  fp = fopen(file, "rb");
+  if (fp == NULL) {
+    perror(file);
+    return 1;
+  }
+
+  VCapHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || strcmp(h.magic, VCAP_MAGIC) != 0 || h.fps == 0) {
+    fprintf(stderr, "%s is not a screen capture of NEMU\n", file);
+    return 1;
+  }
+  uint64_t nr_pixel = (uint64_t)h.width * h.height;
+  uint32_t *pixels = calloc(nr_pixel, sizeof(uint32_t));
+  uint8_t *yuv = malloc(nr_pixel * 3);
+  uint8_t *buf = NULL;
+  size_t buf_size = 0;
+  if (pixels == NULL || yuv == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  printf("YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", h.width, h.height, h.fps);
+
+  uint64_t nr_out = 0;
+  bool first = true;
+  VCapFrame f;
+  while (fread(&f, sizeof(f), 1, fp) == 1) {
+    // repeat the previous frame until the time of this one
+    uint64_t n = f.time * h.fps / 1000000;
+    while (!first && nr_out < n) { put_frame(pixels, nr_pixel, yuv); nr_out ++; }
+    if (f.len > buf_size) {
+      buf_size = f.len;
+      buf = realloc(buf, buf_size);
+      if (buf == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+      }
+    }
+    get(buf, f.len);
+    apply(pixels, nr_pixel, buf, buf + f.len);
+    if (first) nr_out = n;
+    first = false;
+  }
+  if (!first) put_frame(pixels, nr_pixel, yuv);
+
+  free(buf);
+  free(yuv);
+  free(pixels);
+  fclose(fp);
+  return 0;
+}